@@ -18,6 +18,7 @@
 #include <android-base/strings.h>
 
 #include "meminfo_private.h"
+#include "smapsparser.h"
 
 namespace android {
 namespace meminfo {
@@ -33,117 +34,114 @@ bool ExtractAndroidHeapStatsFromFile(const std::string& smaps_path, AndroidHeapS
     uint64_t prev_end = 0;
     int prev_heap = HEAP_UNKNOWN;
 
-    auto vma_scan = [&](const Vma& vma) {
+    auto vma_scan = [&](const VmaView& vma) {
         int which_heap = HEAP_UNKNOWN;
         int sub_heap = HEAP_UNKNOWN;
         bool is_swappable = false;
-        std::string name;
-        if (base::EndsWith(vma.name, " (deleted)")) {
-            name = vma.name.substr(0, vma.name.size() - strlen(" (deleted)"));
-        } else {
-            name = vma.name;
-        }
+        std::string_view vma_name = vma.name;
+        base::ConsumeSuffix(&vma_name, " (deleted)");
 
-        uint32_t namesz = name.size();
-        if (base::StartsWith(name, "[heap]")) {
+        uint32_t namesz = vma_name.size();
+        if (base::StartsWith(vma_name, "[heap]")) {
             which_heap = HEAP_NATIVE;
-        } else if (base::StartsWith(name, "[anon:libc_malloc]")) {
+        } else if (base::StartsWith(vma_name, "[anon:libc_malloc]")) {
             which_heap = HEAP_NATIVE;
-        } else if (base::StartsWith(name, "[anon:scudo:")) {
+        } else if (base::StartsWith(vma_name, "[anon:scudo:")) {
             which_heap = HEAP_NATIVE;
-        } else if (base::StartsWith(name, "[anon:GWP-ASan")) {
+        } else if (base::StartsWith(vma_name, "[anon:GWP-ASan")) {
             which_heap = HEAP_NATIVE;
-        } else if (base::StartsWith(name, "[stack")) {
+        } else if (base::StartsWith(vma_name, "[stack")) {
             which_heap = HEAP_STACK;
-        } else if (base::StartsWith(name, "[anon:stack_and_tls:")) {
+        } else if (base::StartsWith(vma_name, "[anon:stack_and_tls:")) {
             which_heap = HEAP_STACK;
-        } else if (base::EndsWith(name, ".so")) {
+        } else if (base::EndsWith(vma_name, ".so")) {
             which_heap = HEAP_SO;
             is_swappable = true;
-        } else if (base::EndsWith(name, ".jar")) {
+        } else if (base::EndsWith(vma_name, ".jar")) {
             which_heap = HEAP_JAR;
             is_swappable = true;
-        } else if (base::EndsWith(name, ".apk")) {
+        } else if (base::EndsWith(vma_name, ".apk")) {
             which_heap = HEAP_APK;
             is_swappable = true;
-        } else if (base::EndsWith(name, ".ttf")) {
+        } else if (base::EndsWith(vma_name, ".ttf")) {
             which_heap = HEAP_TTF;
             is_swappable = true;
-        } else if ((base::EndsWith(name, ".odex")) ||
-                   (namesz > 4 && strstr(name.c_str(), ".dex") != nullptr)) {
+        } else if ((base::EndsWith(vma_name, ".odex")) ||
+                   (namesz > 4 && vma_name.find(".dex") != std::string_view::npos)) {
             which_heap = HEAP_DEX;
             sub_heap = HEAP_DEX_APP_DEX;
             is_swappable = true;
-        } else if (base::EndsWith(name, ".vdex")) {
+        } else if (base::EndsWith(vma_name, ".vdex")) {
             which_heap = HEAP_DEX;
             // Handle system@framework@boot and system/framework/boot|apex
-            if ((strstr(name.c_str(), "@boot") != nullptr) ||
-                (strstr(name.c_str(), "/boot") != nullptr) ||
-                (strstr(name.c_str(), "/apex") != nullptr)) {
+            if ((vma_name.find("@boot") != std::string_view::npos) ||
+                (vma_name.find("/boot") != std::string_view::npos) ||
+                (vma_name.find("/apex") != std::string_view::npos)) {
                 sub_heap = HEAP_DEX_BOOT_VDEX;
             } else {
                 sub_heap = HEAP_DEX_APP_VDEX;
             }
             is_swappable = true;
-        } else if (base::EndsWith(name, ".oat")) {
+        } else if (base::EndsWith(vma_name, ".oat")) {
             which_heap = HEAP_OAT;
             is_swappable = true;
-        } else if (base::EndsWith(name, ".art") || base::EndsWith(name, ".art]")) {
+        } else if (base::EndsWith(vma_name, ".art") || base::EndsWith(vma_name, ".art]")) {
             which_heap = HEAP_ART;
             // Handle system@framework@boot* and system/framework/boot|apex*
-            if ((strstr(name.c_str(), "@boot") != nullptr) ||
-                (strstr(name.c_str(), "/boot") != nullptr) ||
-                (strstr(name.c_str(), "/apex") != nullptr)) {
+            if ((vma_name.find("@boot") != std::string_view::npos) ||
+                (vma_name.find("/boot") != std::string_view::npos) ||
+                (vma_name.find("/apex") != std::string_view::npos)) {
                 sub_heap = HEAP_ART_BOOT;
             } else {
                 sub_heap = HEAP_ART_APP;
             }
             is_swappable = true;
-        } else if (base::StartsWith(name, "/dev/")) {
+        } else if (base::StartsWith(vma_name, "/dev/")) {
             which_heap = HEAP_UNKNOWN_DEV;
-            if (base::StartsWith(name, "/dev/kgsl-3d0")) {
+            if (base::StartsWith(vma_name, "/dev/kgsl-3d0")) {
                 which_heap = HEAP_GL_DEV;
-            } else if (base::StartsWith(name, "/dev/ashmem/CursorWindow")) {
+            } else if (base::StartsWith(vma_name, "/dev/ashmem/CursorWindow")) {
                 which_heap = HEAP_CURSOR;
-            } else if (base::StartsWith(name, "/dev/ashmem/jit-zygote-cache")) {
+            } else if (base::StartsWith(vma_name, "/dev/ashmem/jit-zygote-cache")) {
                 which_heap = HEAP_DALVIK_OTHER;
                 sub_heap = HEAP_DALVIK_OTHER_ZYGOTE_CODE_CACHE;
-            } else if (base::StartsWith(name, "/dev/ashmem")) {
+            } else if (base::StartsWith(vma_name, "/dev/ashmem")) {
                 which_heap = HEAP_ASHMEM;
             }
-        } else if (base::StartsWith(name, "/memfd:jit-cache")) {
+        } else if (base::StartsWith(vma_name, "/memfd:jit-cache")) {
             which_heap = HEAP_DALVIK_OTHER;
             sub_heap = HEAP_DALVIK_OTHER_APP_CODE_CACHE;
-        } else if (base::StartsWith(name, "/memfd:jit-zygote-cache")) {
+        } else if (base::StartsWith(vma_name, "/memfd:jit-zygote-cache")) {
             which_heap = HEAP_DALVIK_OTHER;
             sub_heap = HEAP_DALVIK_OTHER_ZYGOTE_CODE_CACHE;
-        } else if (base::StartsWith(name, "[anon:")) {
+        } else if (base::StartsWith(vma_name, "[anon:")) {
             which_heap = HEAP_UNKNOWN;
-            if (base::StartsWith(name, "[anon:dalvik-")) {
+            if (base::StartsWith(vma_name, "[anon:dalvik-")) {
                 which_heap = HEAP_DALVIK_OTHER;
-                if (base::StartsWith(name, "[anon:dalvik-LinearAlloc")) {
+                if (base::StartsWith(vma_name, "[anon:dalvik-LinearAlloc")) {
                     sub_heap = HEAP_DALVIK_OTHER_LINEARALLOC;
-                } else if (base::StartsWith(name, "[anon:dalvik-alloc space") ||
-                           base::StartsWith(name, "[anon:dalvik-main space")) {
+                } else if (base::StartsWith(vma_name, "[anon:dalvik-alloc space") ||
+                           base::StartsWith(vma_name, "[anon:dalvik-main space")) {
                     // This is the regular Dalvik heap.
                     which_heap = HEAP_DALVIK;
                     sub_heap = HEAP_DALVIK_NORMAL;
-                } else if (base::StartsWith(name, "[anon:dalvik-large object space") ||
-                           base::StartsWith(name, "[anon:dalvik-free list large object space")) {
+                } else if (base::StartsWith(vma_name, "[anon:dalvik-large object space") ||
+                           base::StartsWith(vma_name,
+                                            "[anon:dalvik-free list large object space")) {
                     which_heap = HEAP_DALVIK;
                     sub_heap = HEAP_DALVIK_LARGE;
-                } else if (base::StartsWith(name, "[anon:dalvik-non moving space")) {
+                } else if (base::StartsWith(vma_name, "[anon:dalvik-non moving space")) {
                     which_heap = HEAP_DALVIK;
                     sub_heap = HEAP_DALVIK_NON_MOVING;
-                } else if (base::StartsWith(name, "[anon:dalvik-zygote space")) {
+                } else if (base::StartsWith(vma_name, "[anon:dalvik-zygote space")) {
                     which_heap = HEAP_DALVIK;
                     sub_heap = HEAP_DALVIK_ZYGOTE;
-                } else if (base::StartsWith(name, "[anon:dalvik-indirect ref")) {
+                } else if (base::StartsWith(vma_name, "[anon:dalvik-indirect ref")) {
                     sub_heap = HEAP_DALVIK_OTHER_INDIRECT_REFERENCE_TABLE;
-                } else if (base::StartsWith(name, "[anon:dalvik-jit-code-cache") ||
-                           base::StartsWith(name, "[anon:dalvik-data-code-cache")) {
+                } else if (base::StartsWith(vma_name, "[anon:dalvik-jit-code-cache") ||
+                           base::StartsWith(vma_name, "[anon:dalvik-data-code-cache")) {
                     sub_heap = HEAP_DALVIK_OTHER_APP_CODE_CACHE;
-                } else if (base::StartsWith(name, "[anon:dalvik-CompilerMetadata")) {
+                } else if (base::StartsWith(vma_name, "[anon:dalvik-CompilerMetadata")) {
                     sub_heap = HEAP_DALVIK_OTHER_COMPILER_METADATA;
                 } else {
                     sub_heap = HEAP_DALVIK_OTHER_ACCOUNTING;  // Default to accounting.
@@ -198,7 +196,11 @@ bool ExtractAndroidHeapStatsFromFile(const std::string& smaps_path, AndroidHeapS
         return true;
     };
 
-    return ForEachVmaFromFile(smaps_path, vma_scan);
+    // Only the fields used above are parsed.
+    static constexpr uint32_t kFields = kSmapsRss | kSmapsPss | kSmapsSharedClean |
+                                        kSmapsSharedDirty | kSmapsPrivateClean |
+                                        kSmapsPrivateDirty | kSmapsSwap | kSmapsSwapPss;
+    return ForEachSmapsVma<kFields>(smaps_path, vma_scan, true, nullptr);
 }
 }  // namespace meminfo
 }  // namespace android
\ No newline at end of file
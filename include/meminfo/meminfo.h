@@ -16,17 +16,25 @@
 
 #pragma once
 
+#include <stdint.h>
 #include <string.h>
 #include <sys/types.h>
 #include <unistd.h>
 
 #include <string>
+#include <string_view>
+#include <type_traits>
 #include <vector>
 
 namespace android {
 namespace meminfo {
 
+// The counters are laid out back to back with no other members, so the arithmetic below works
+// on all of them as one array, which the compiler turns into a few vector instructions. New
+// counters must be uint64_t and be added to kNumCounters.
 struct MemUsage {
+    static constexpr size_t kNumCounters = 17;
+
     uint64_t vss;
     uint64_t rss;
     uint64_t pss;
@@ -70,12 +78,45 @@ struct MemUsage {
 
     ~MemUsage() = default;
 
-    void clear() {
-        vss = rss = pss = uss = swap = swap_pss = 0;
-        private_clean = private_dirty = shared_clean = shared_dirty = 0;
+    void clear() { *this = MemUsage(); }
+
+    MemUsage& operator+=(const MemUsage& other) {
+        return Apply(other, [](uint64_t a, uint64_t b) { return a + b; });
+    }
+    MemUsage& operator-=(const MemUsage& other) {
+        return Apply(other, [](uint64_t a, uint64_t b) { return a - b; });
+    }
+    // Subtracts 'other' from each counter, stopping at 0 for counters that would go below it.
+    MemUsage& SaturatingSub(const MemUsage& other) {
+        return Apply(other, [](uint64_t a, uint64_t b) { return a > b ? a - b : 0; });
+    }
+    MemUsage& operator*=(uint64_t factor) {
+        return Apply(*this, [factor](uint64_t a, uint64_t) { return a * factor; });
+    }
+
+    bool operator==(const MemUsage& other) const = default;
+
+  private:
+    template <typename Op>
+    MemUsage& Apply(const MemUsage& other, Op op) {
+        uint64_t lhs[kNumCounters];
+        uint64_t rhs[kNumCounters];
+        memcpy(lhs, this, sizeof(lhs));
+        memcpy(rhs, &other, sizeof(rhs));
+        for (size_t i = 0; i < kNumCounters; i++) {
+            lhs[i] = op(lhs[i], rhs[i]);
+        }
+        memcpy(this, lhs, sizeof(lhs));
+        return *this;
     }
 };
 
+static_assert(std::is_trivially_copyable_v<MemUsage> &&
+                      sizeof(MemUsage) == MemUsage::kNumCounters * sizeof(uint64_t),
+              "MemUsage must only hold its uint64_t counters");
+
+struct VmaView;
+
 struct Vma {
     uint64_t start;
     uint64_t end;
@@ -89,13 +130,51 @@ struct Vma {
     Vma(uint64_t s, uint64_t e, uint64_t off, uint16_t f, const std::string& n,
         uint64_t iNode, bool is_shared)
         : start(s), end(e), offset(off), flags(f), name(n), inode(iNode), is_shared(is_shared) {}
+    // Makes an owned copy of 'view', e.g. to keep a vma handed out by an in place parser past
+    // its callback.
+    explicit Vma(const VmaView& view);
     ~Vma() = default;
 
-    void clear() { memset(&usage, 0, sizeof(usage)); }
+    void clear() { usage.clear(); }
+
+    // Copies 'view', reusing the storage of 'name'.
+    Vma& operator=(const VmaView& view);
+
+    // Memory usage of this mapping.
+    MemUsage usage;
+};
+
+// A vma as handed out by parsers that work in place, see ForEachVmaViewFromFile(). 'name'
+// points into the parser's buffer and is only valid until the callback returns; consumers that
+// keep the vma convert it to a Vma.
+struct VmaView {
+    uint64_t start = 0;
+    uint64_t end = 0;
+    uint64_t offset = 0;
+    uint16_t flags = 0;
+    std::string_view name;
+    uint64_t inode = 0;
+    bool is_shared = false;
 
     // Memory usage of this mapping.
     MemUsage usage;
 };
 
+inline Vma::Vma(const VmaView& view) : Vma() {
+    *this = view;
+}
+
+inline Vma& Vma::operator=(const VmaView& view) {
+    start = view.start;
+    end = view.end;
+    offset = view.offset;
+    flags = view.flags;
+    name.assign(view.name);
+    inode = view.inode;
+    is_shared = view.is_shared;
+    usage = view.usage;
+    return *this;
+}
+
 }  // namespace meminfo
 }  // namespace android
@@ -19,6 +19,9 @@
 #include <sys/types.h>
 #include <unistd.h>
 
+#include <memory>
+#include <mutex>
+#include <span>
 #include <string>
 #include <vector>
 
@@ -39,18 +42,50 @@ class PageAcct final {
     bool PageFlags(uint64_t pfn, uint64_t* flags);
     bool PageMapCount(uint64_t pfn, uint64_t* mapcount);
 
+    // Batched versions of PageFlags() and PageMapCount(). The value for pfns[i] is
+    // stored in flags[i] (or mapcounts[i]), both spans must have the same size.
+    // 'pfns' may be in any order and contain duplicates. The page frames are sorted
+    // and deduplicated, and frames that are close to each other are fetched with
+    // a single windowed read, so callers should pass all the page frames they need
+    // at once rather than making several small calls.
+    bool PageFlagsBatch(std::span<const uint64_t> pfns, std::span<uint64_t> flags);
+    bool PageMapCountBatch(std::span<const uint64_t> pfns, std::span<uint64_t> mapcounts);
+
     int IsPageIdle(uint64_t pfn);
 
+    // Batched idle page tracking on top of /sys/kernel/mm/page_idle/bitmap.
+    // MarkPagesIdle() sets the idle flag of every page frame in 'pfns', GetPagesIdle()
+    // stores whether pfns[i] is still idle (i.e. was not accessed since it was marked) in
+    // idle[i]; both spans must have the same size. 'pfns' may be in any order and contain
+    // duplicates. The bitmap words covering the page frames are built or read in memory,
+    // and nearby words are written or read together, so a whole set of page frames costs a
+    // few large syscalls instead of two per page.
+    bool MarkPagesIdle(std::span<const uint64_t> pfns);
+    bool GetPagesIdle(std::span<const uint64_t> pfns, std::span<uint8_t> idle);
+
+    // Starts a system-wide scan. Until the matching EndScan(), page flags and map counts
+    // are cached by page frame number, so pages shared by many processes (libraries,
+    // zygote heap) are only read from the kernel once per scan instead of once per
+    // process that maps them. Values may go stale while the scan is running; this is
+    // intended for tools like procrank and librank that take a single snapshot.
+    // Scans may be nested, the cache is dropped when the outermost scan ends.
+    void BeginScan();
+    void EndScan();
+
     // The only way to create PageAcct object
     static PageAcct& Instance() {
         static PageAcct instance;
         return instance;
     }
 
-    ~PageAcct() = default;
+    ~PageAcct();
 
   private:
-    PageAcct() : kpagecount_fd_(-1), kpageflags_fd_(-1), pageidle_fd_(-1) {}
+    class PageAttrCache;
+    enum PageAttr { kPageFlags = 0, kPageMapCount, kNumPageAttrs };
+
+    PageAcct();
+    bool ReadPageAttrs(PageAttr attr, std::span<const uint64_t> pfns, std::span<uint64_t> out);
     int MarkPageIdle(uint64_t pfn) const;
     int GetPageIdle(uint64_t pfn) const;
 
@@ -63,6 +98,11 @@ class PageAcct final {
     ::android::base::unique_fd kpagecount_fd_;
     ::android::base::unique_fd kpageflags_fd_;
     ::android::base::unique_fd pageidle_fd_;
+
+    // Guards the scan cache, which may be used by several threads walking page maps.
+    std::mutex scan_lock_;
+    uint32_t scan_depth_;
+    std::unique_ptr<PageAttrCache> scan_cache_;
 };
 
 // Returns if the page present bit is set in the value
@@ -73,9 +113,24 @@ bool page_present(uint64_t pagemap_val);
 // passed in.
 bool page_swapped(uint64_t pagemap_val);
 
+// Returns if the soft-dirty bit is set in the value
+// passed in.
+bool page_soft_dirty(uint64_t pagemap_val);
+
 // Returns the page frame number (physical page) from
 // pagemap value
 uint64_t page_pfn(uint64_t pagemap_val);
 
+// Sorts a chunk of pagemap values into present, swapped and absent pages, 64 at a
+// time with SIMD where available. Bit i % 64 of present_mask[i / 64] (swapped_mask[i / 64])
+// is set if entries[i] is present (swapped out); both masks need (entries.size() + 63) / 64
+// words, so absent stretches show up as zero words in both. The page frame numbers of the
+// present pages are stored in order at the start of 'pfns', which must be at least as large
+// as 'entries'. The number of present and swapped out pages is stored in 'nr_present' and
+// 'nr_swapped'.
+bool ClassifyPageMap(std::span<const uint64_t> entries, std::span<uint64_t> present_mask,
+                     std::span<uint64_t> swapped_mask, std::span<uint64_t> pfns,
+                     size_t* nr_present, size_t* nr_swapped);
+
 }  // namespace meminfo
 }  // namespace android
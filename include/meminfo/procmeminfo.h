@@ -18,24 +18,121 @@
 
 #include <sys/types.h>
 
+#include <chrono>
 #include <functional>
+#include <memory>
+#include <span>
 #include <string>
 #include <string_view>
+#include <type_traits>
 #include <vector>
 
+#include <android-base/unique_fd.h>
+#include <procinfo/process_map.h>
+
 #include "meminfo.h"
+#include "procstatus.h"
+#include "swapslotlist.h"
 
 namespace android {
 namespace meminfo {
 
 using VmaCallback = std::function<bool(Vma&)>;
 
+// Enables the templated overloads of the vma iterators for callables taking a 'Vma&' and
+// returning bool. Those call the callable directly, so it can be inlined into the loop over
+// the vmas, instead of through a std::function.
+template <typename Fn>
+using EnableIfVmaCallable = std::enable_if_t<std::is_invocable_r_v<bool, Fn&, Vma&>>;
+
+// Non-owning reference to a callable taking a 'const VmaView&' and returning bool, which
+// is cheaper to make and call than a std::function. The callable must outlive the reference.
+class VmaViewCallback final {
+  public:
+    template <typename Fn, typename = std::enable_if_t<
+                                   !std::is_same_v<std::decay_t<Fn>, VmaViewCallback>>>
+    VmaViewCallback(Fn&& fn)
+        : obj_(const_cast<void*>(static_cast<const void*>(std::addressof(fn)))),
+          call_([](void* obj, const VmaView& vma) -> bool {
+              return (*static_cast<std::remove_reference_t<Fn>*>(obj))(vma);
+          }) {}
+
+    bool operator()(const VmaView& vma) const { return call_(obj_, vma); }
+
+  private:
+    void* obj_;
+    bool (*call_)(void*, const VmaView&);
+};
+
+// Scratch space that the readers of per-process files can reuse across calls, so that once
+// it has grown to fit, reading doesn't allocate. One context must not be used by two threads
+// at once.
+struct ParseContext {
+    // Read buffer.
+    std::string buffer;
+    // Path of the file being read, for the ProcMemInfo methods that format it.
+    std::string path;
+    // The vma passed to ForEachVmaFromFile() callbacks, whose name keeps its storage.
+    Vma vma;
+};
+
+// Outcome of reading one process in ProcMemInfo::SmapsOrRollupBatch().
+enum class SmapsReadStatus : uint8_t {
+    kOk = 0,
+    // The process exited, or there is no process with that pid.
+    kGone,
+    // The caller isn't allowed to read the process's smaps.
+    kPermissionDenied,
+    // Reading failed for another reason.
+    kError,
+    // Not read because the deadline passed first.
+    kDeadlineExceeded,
+};
+
+struct SmapsOrRollupBatchOptions {
+    // Number of threads reading processes at the same time, including the calling thread.
+    uint32_t num_threads = 1;
+    // Processes not started by then aren't read. Reads already under way are finished.
+    std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::time_point::max();
+};
+
+// Called with consecutive page map entries and the virtual address of the first of them.
+using PageMapChunkCallback =
+        std::function<bool(std::span<const uint64_t> entries, uint64_t first_vaddr)>;
+
 class ProcMemInfo final {
     // Per-process memory accounting
   public:
     // Reset the working set accounting of the process via /proc/<pid>/clear_refs
     static bool ResetWorkingSet(pid_t pid);
 
+    // Returns 'true' if the kernel tracks soft-dirty pages (CONFIG_MEM_SOFT_DIRTY). Without
+    // it, ResetSoftDirty(), SoftDirtyWss() and MapsWithSoftDirty() fail.
+    static bool KernelHasSoftDirty();
+
+    // Clears the soft-dirty bits of all pages of each process in 'pids' via
+    // /proc/<pid>/clear_refs, starting a new write working set interval for
+    // MapsWithSoftDirty() and SoftDirtyWss(). All processes are attempted, returns 'false'
+    // if any of them failed.
+    static bool ResetSoftDirty(std::span<const pid_t> pids);
+    static bool ResetSoftDirty(pid_t pid) { return ResetSoftDirty({&pid, 1}); }
+
+    // Reads the write working set of each process in 'pids' into wss[i]; both spans must
+    // have the same size. See MapsWithSoftDirty() for the fields that are set. Processes
+    // that can't be read (e.g. they exited) get a zeroed usage and make the call return
+    // 'false', the others are still read.
+    static bool SoftDirtyWss(std::span<const pid_t> pids, std::span<MemUsage> wss);
+
+    // Same as SmapsOrRollup() for each process in 'pids', into stats[i]; both spans must have
+    // the same size. Most of the time goes to the kernel walking each process's page tables,
+    // so the processes are spread over up to 'options.num_threads' threads. If 'status' isn't
+    // empty it must have the same size too, and status[i] is set to the outcome for pids[i].
+    // Processes that aren't read get a zeroed usage and make the call return 'false', the
+    // others are still read.
+    static bool SmapsOrRollupBatch(std::span<const pid_t> pids, std::span<MemUsage> stats,
+                                   std::span<SmapsReadStatus> status = {},
+                                   const SmapsOrRollupBatchOptions& options = {});
+
     ProcMemInfo(pid_t pid, bool get_wss = false, uint64_t pgflags = 0, uint64_t pgflags_mask = 0);
 
     const std::vector<Vma>& Maps();
@@ -47,6 +144,14 @@ class ProcMemInfo final {
     // vector.
     const std::vector<Vma>& MapsWithPageIdle();
 
+    // Same as Maps() except, the usage of each map is its write working set using soft-dirty
+    // tracking (CONFIG_MEM_SOFT_DIRTY): the pages written since the last ResetSoftDirty().
+    // Only vss (same as rss), rss, uss and swap are set, all from a single pass over
+    // /proc/<pid>/pagemap without reading /proc/kpageflags or /proc/kpagecount. uss uses
+    // the "exclusively mapped" bit of the page map entry. Wss() returns the totals if the
+    // object was created with 'get_wss' set.
+    const std::vector<Vma>& MapsWithSoftDirty();
+
     // Same as Maps() except, do not read the usage stats for each map.
     const std::vector<Vma>& MapsWithoutUsageStats();
 
@@ -59,10 +164,38 @@ class ProcMemInfo final {
     // called, this function will fill in usage stats for all vmas in 'maps_'.
     bool GetUsageStats(bool get_wss, bool use_pageidle = false, bool update_mem_usage = true);
 
+    // Sets the number of threads GetUsageStats() (and so Maps(), Usage() and Wss()) may use
+    // to walk /proc/<pid>/pagemap. Large vmas are split into page ranges that are processed
+    // by a pool of workers, and the per-range results are merged in address order, so the
+    // stats and swap offsets are the same as those of a serial walk. The default of 1 walks
+    // the page map on the calling thread.
+    void SetUsageStatsThreads(uint32_t num_threads) { usage_stats_threads_ = num_threads; }
+
+    // Starts a session: until EndSession() or the object is destroyed, /proc/<pid>/pagemap
+    // is kept open and page map entries are read through a single buffer of up to
+    // 'max_buffer_bytes', instead of reopening the file and allocating a buffer on each call
+    // to FillInVmaStats(), PageMap(), GetUsageStats() and the methods built on them. Meant
+    // for tools that call FillInVmaStats() for each vma in a loop.
+    // Returns false if a session is already started or the page map can't be opened.
+    bool BeginSession(size_t max_buffer_bytes = kDefaultSessionBufferBytes);
+    void EndSession();
+
+    static constexpr size_t kDefaultSessionBufferBytes = 256 * 1024;
+
+    // Fast alternative to Usage() for callers that don't need Pss. Computes the process's vss,
+    // rss, uss and swap from /proc/<pid>/pagemap alone, telling private pages from shared ones
+    // by the "exclusively mapped" bit of their page map entry, so /proc/kpagecount is never
+    // read. If 'read_page_flags' is 'true', /proc/kpageflags is read as well to fill in
+    // {private,shared}_{clean,dirty} and thp; it is also read if a page flags filter was given
+    // to the constructor. All other fields of 'usage' are zeroed, and the vmas' own usage is
+    // left alone.
+    // Returns 'false' if anything goes wrong.
+    bool UsageFromPageMap(MemUsage* usage, bool read_page_flags = false);
+
     // Collect all 'vma' or 'maps' from /proc/<pid>/smaps and store them in 'maps_'.
     // If 'collect_usage' is 'true', this method will populate 'usage_' as vmas are being
     // collected. If 'collect_swap_offsets' is 'true', pagemap will be read in order to
-    // populate 'swap_offsets_'.
+    // collect the swap slots returned by SwapSlots().
     //
     // Returns a constant reference to the vma vector after the collection is
     // done.
@@ -77,20 +210,28 @@ class ProcMemInfo final {
     // passed to the callback.
     // Returns 'false' if the file is malformed.
     bool ForEachVma(const VmaCallback& callback, bool use_smaps = true);
+    template <typename Fn, typename = EnableIfVmaCallable<Fn>>
+    bool ForEachVma(Fn&& callback, bool use_smaps = true);
 
     // Reads all VMAs from /proc/<pid>/maps and calls the callback() for each one of them.
     // Returns false in case of failure during parsing.
     bool ForEachVmaFromMaps(const VmaCallback& callback);
+    template <typename Fn, typename = EnableIfVmaCallable<Fn>>
+    bool ForEachVmaFromMaps(Fn&& callback);
 
     // Similar to other VMA reading methods, except this one allows passing a reusable buffer
     // to store the /proc/<pid>/maps content
     bool ForEachVmaFromMaps(const VmaCallback& callback, std::string& mapsBuffer);
+    template <typename Fn, typename = EnableIfVmaCallable<Fn>>
+    bool ForEachVmaFromMaps(Fn&& callback, std::string& mapsBuffer);
 
     // Takes the existing VMAs in 'maps_' and calls the callback() for each one
     // of them. This is intended to avoid parsing /proc/<pid>/maps or
     // /proc/<pid>/smaps twice.
     // Returns false if 'maps_' is empty.
     bool ForEachExistingVma(const VmaCallback& callback);
+    template <typename Fn, typename = EnableIfVmaCallable<Fn>>
+    bool ForEachExistingVma(Fn&& callback);
 
     // Used to parse either of /proc/<pid>/{smaps, smaps_rollup} and record the process's
     // Pss and Private memory usage in 'stats'.  In particular, the method only populates the fields
@@ -105,11 +246,14 @@ class ProcMemInfo final {
     //   SwapPss
     // All other fields of MemUsage are zeroed.
     bool SmapsOrRollup(MemUsage* stats) const;
+    // Same as above, with the path and read buffer kept in 'ctx'.
+    bool SmapsOrRollup(MemUsage* stats, ParseContext& ctx) const;
 
     // Used to parse either of /proc/<pid>/{smaps, smaps_rollup} and record the process's
     // Pss.
     // Returns 'true' on success and the value of Pss in the out parameter.
     bool SmapsOrRollupPss(uint64_t* pss) const;
+    bool SmapsOrRollupPss(uint64_t* pss, ParseContext& ctx) const;
 
     // Used to parse /proc/<pid>/status and record the process's RSS memory as
     // reported by VmRSS. This is cheaper than using smaps or maps. VmRSS as
@@ -118,9 +262,21 @@ class ProcMemInfo final {
     //
     // Returns 'true' on success and the value of VmRSS in the out parameter.
     bool StatusVmRSS(uint64_t* rss) const;
+    // Same as above, formatting the path into 'ctx'.
+    bool StatusVmRSS(uint64_t* rss, ParseContext& ctx) const;
 
+    // Reads the 'fields' (see ProcStatusField) of /proc/<pid>/status in a single pass, see
+    // ReadProcStatus(). Use this instead of StatusVmRSS() when more than VmRSS is needed.
+    bool Status(uint32_t fields, ProcStatus* status) const;
+
+    // Returns the swap offsets of the swapped out pages found by the page map walks that
+    // collected them so far, in order of swap type and offset. Pages on different swap
+    // devices may have the same offset; use SwapSlots() to tell them apart.
     const std::vector<uint64_t>& SwapOffsets();
 
+    // Same as above, as swap slots grouped by swap type and packed.
+    const SwapSlotList& SwapSlots();
+
     // Reads /proc/<pid>/pagemap for this process for each page within
     // the 'vma' and stores that in 'pagemap'. It is assumed that the 'vma'
     // is obtained by calling Maps() or 'ForEachVma' for the same object. No special checks
@@ -128,22 +284,75 @@ class ProcMemInfo final {
     // Returns false if anything goes wrong, 'true' otherwise.
     bool PageMap(const Vma& vma, std::vector<uint64_t>* pagemap);
 
+    // Reads /proc/<pid>/pagemap for each page within the 'vma' in fixed size chunks and calls
+    // the callback() with each chunk, so whole address spaces can be walked in constant
+    // memory. Chunks are read into 'buffer' if it isn't empty, otherwise into the session
+    // buffer (see BeginSession()) or an internal one. The entries are only valid during the
+    // callback. Returning 'false' from the callback stops the walk.
+    // Returns false if anything goes wrong or the walk was stopped, 'true' otherwise.
+    bool ForEachPageMapChunk(const Vma& vma, const PageMapChunkCallback& callback,
+                             std::span<uint64_t> buffer = {});
+
+    // Same as above for each of 'vmas', which must be sorted by address. Vmas that abut are
+    // read together, so a chunk may span several of them.
+    bool ForEachPageMapChunk(std::span<const Vma> vmas, const PageMapChunkCallback& callback,
+                             std::span<uint64_t> buffer = {});
+
     ~ProcMemInfo() = default;
 
   private:
     bool ReadMaps(bool get_wss, bool use_pageidle = false, bool get_usage_stats = true,
                   bool update_mem_usage = true);
+    bool ReadSoftDirtyStats();
+    // Returns the session's page map fd, or opens the page map into 'fd' if there is no
+    // session. Returns -1 on failure.
+    int PagemapFd(::android::base::unique_fd* fd) const;
+    // Returns the session's read buffer, or nullptr if there is no session.
+    std::vector<uint64_t>* SessionPageCache();
+    size_t SessionMaxPages() const;
+    bool GetUsageStatsParallel(int pagemap_fd, bool get_wss, bool use_pageidle,
+                               bool update_mem_usage);
     bool ReadVmaStats(int pagemap_fd, Vma& vma, bool get_wss, bool use_pageidle,
                       bool update_mem_usage, bool update_swap_usage);
+    // Walks pages [first_page, last_page) of the process and adds their stats to 'usage'
+    // and their packed swap slots to 'swap_slots'. The page map is read through 'page_cache',
+    // or a local buffer if null. Does not modify the object, so ranges can be walked
+    // concurrently with separate (or null) buffers.
+    bool ReadPageRangeStats(int pagemap_fd, size_t first_page, size_t last_page, bool get_wss,
+                            bool use_pageidle, bool update_mem_usage, bool update_swap_usage,
+                            MemUsage* usage, std::vector<uint64_t>* swap_slots,
+                            std::vector<uint64_t>* page_cache) const;
 
     pid_t pid_;
     bool get_wss_;
     uint64_t pgflags_;
     uint64_t pgflags_mask_;
+    uint32_t usage_stats_threads_;
+
+    // State of the current session, see BeginSession(). Copies of the object start without
+    // a session.
+    struct Session {
+        ::android::base::unique_fd pagemap_fd;
+        std::vector<uint64_t> page_cache;
+        size_t max_pages = 0;
+
+        Session() = default;
+        Session(const Session&) {}
+        Session& operator=(const Session&) {
+            *this = Session();
+            return *this;
+        }
+        Session& operator=(Session&&) = default;
+    };
+    Session session_;
 
     std::vector<Vma> maps_;
 
     MemUsage usage_;
+    // Swap slots found by page map walks, packed into 'swap_slot_list_' by SwapSlots().
+    std::vector<uint64_t> swap_slots_;
+    SwapSlotList swap_slot_list_;
+    // Only filled in by SwapOffsets().
     std::vector<uint64_t> swap_offsets_;
 };
 
@@ -154,6 +363,94 @@ class ProcMemInfo final {
 // Returns 'false' if the file is malformed.
 bool ForEachVmaFromFile(const std::string& path, const VmaCallback& callback,
                         bool read_smaps_fields = true);
+template <typename Fn, typename = EnableIfVmaCallable<Fn>>
+bool ForEachVmaFromFile(const std::string& path, Fn&& callback, bool read_smaps_fields = true);
+// Same as above, reusing the buffers in 'ctx'.
+bool ForEachVmaFromFile(const std::string& path, const VmaCallback& callback,
+                        bool read_smaps_fields, ParseContext& ctx);
+template <typename Fn, typename = EnableIfVmaCallable<Fn>>
+bool ForEachVmaFromFile(const std::string& path, Fn&& callback, bool read_smaps_fields,
+                        ParseContext& ctx);
+
+// Same as ForEachVmaFromFile(), but the file is read with large reads into 'buffer' (a local
+// one if null), which can be reused across calls, and parsed in place. The vmas passed to
+// 'callback' point into 'buffer', see VmaView.
+bool ForEachVmaViewFromFile(const std::string& path, VmaViewCallback callback,
+                            bool read_smaps_fields = true, std::string* buffer = nullptr);
+
+template <typename Fn, typename>
+bool ForEachVmaFromFile(const std::string& path, Fn&& callback, bool read_smaps_fields,
+                        ParseContext& ctx) {
+    Vma& vma = ctx.vma;
+    auto copy_vma = [&](const VmaView& view) {
+        vma = view;
+        return callback(vma);
+    };
+    return ForEachVmaViewFromFile(path, copy_vma, read_smaps_fields, &ctx.buffer);
+}
+
+template <typename Fn, typename>
+bool ForEachVmaFromFile(const std::string& path, Fn&& callback, bool read_smaps_fields) {
+    ParseContext ctx;
+    return ForEachVmaFromFile(path, callback, read_smaps_fields, ctx);
+}
+
+template <typename Fn, typename>
+bool ProcMemInfo::ForEachVma(Fn&& callback, bool use_smaps) {
+    ParseContext ctx;
+    ctx.path = "/proc/" + std::to_string(pid_) + (use_smaps ? "/smaps" : "/maps");
+    return ForEachVmaFromFile(ctx.path, callback, use_smaps, ctx);
+}
+
+template <typename Fn, typename>
+bool ProcMemInfo::ForEachVmaFromMaps(Fn&& callback) {
+    Vma vma;
+    auto vmaCollect = [&callback, &vma](const uint64_t start, uint64_t end, uint16_t flags,
+                                        uint64_t pgoff, ino_t inode, const char* name,
+                                        bool shared) {
+        vma.start = start;
+        vma.end = end;
+        vma.flags = flags;
+        vma.offset = pgoff;
+        vma.name = name;
+        vma.inode = inode;
+        vma.is_shared = shared;
+        callback(vma);
+    };
+    return ::android::procinfo::ReadProcessMaps(pid_, vmaCollect);
+}
+
+template <typename Fn, typename>
+bool ProcMemInfo::ForEachVmaFromMaps(Fn&& callback, std::string& mapsBuffer) {
+    Vma vma;
+    vma.name.reserve(256);
+    auto vmaCollect = [&callback, &vma](const uint64_t start, uint64_t end, uint16_t flags,
+                                        uint64_t pgoff, ino_t inode, const char* name,
+                                        bool shared) {
+        vma.start = start;
+        vma.end = end;
+        vma.flags = flags;
+        vma.offset = pgoff;
+        vma.name = name;
+        vma.inode = inode;
+        vma.is_shared = shared;
+        callback(vma);
+    };
+    return ::android::procinfo::ReadProcessMaps(pid_, vmaCollect, mapsBuffer);
+}
+
+template <typename Fn, typename>
+bool ProcMemInfo::ForEachExistingVma(Fn&& callback) {
+    if (maps_.empty()) {
+        return false;
+    }
+    for (auto& vma : maps_) {
+        if (!callback(vma)) {
+            return false;
+        }
+    }
+    return true;
+}
 
 // Returns if the kernel supports /proc/<pid>/smaps_rollup. Assumes that the
 // calling process has access to the /proc/<pid>/smaps_rollup.
@@ -164,14 +461,17 @@ bool IsSmapsRollupSupported();
 // from a file. The file MUST be in the same format as /proc/<pid>/smaps
 // or /proc/<pid>/smaps_rollup
 bool SmapsOrRollupFromFile(const std::string& path, MemUsage* stats);
+bool SmapsOrRollupFromFile(const std::string& path, MemUsage* stats, ParseContext& ctx);
 
 // Same as ProcMemInfo::SmapsOrRollupPss but reads the statistics directly
 // from a file and returns total Pss in kB. The file MUST be in the same format
 // as /proc/<pid>/smaps or /proc/<pid>/smaps_rollup
 bool SmapsOrRollupPssFromFile(const std::string& path, uint64_t* pss);
+bool SmapsOrRollupPssFromFile(const std::string& path, uint64_t* pss, ParseContext& ctx);
 
 // Same as ProcMemInfo::StatusVmRSS but reads the statistics directly from a file.
 // The file MUST be in the same format as /proc/<pid>/status.
+// status is read into a buffer on the stack, so there is no ParseContext overload.
 bool StatusVmRSSFromFile(const std::string& path, uint64_t* rss);
 
 // The output format that can be specified by user.
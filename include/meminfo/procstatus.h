@@ -0,0 +1,71 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+#include <string>
+
+namespace android {
+namespace meminfo {
+
+// Fields of /proc/<pid>/status, as bits of the masks passed to ReadProcStatus().
+enum ProcStatusField : uint32_t {
+    kStatusVmPeak = 1u << 0,
+    kStatusVmSize = 1u << 1,
+    kStatusVmLck = 1u << 2,
+    kStatusVmHWM = 1u << 3,
+    kStatusVmRSS = 1u << 4,
+    kStatusRssAnon = 1u << 5,
+    kStatusRssFile = 1u << 6,
+    kStatusRssShmem = 1u << 7,
+    kStatusVmSwap = 1u << 8,
+    kStatusThreads = 1u << 9,
+};
+
+inline constexpr uint32_t kStatusAllFields = (1u << 10) - 1;
+
+// Memory usage of a process as reported by /proc/<pid>/status, in kB except for 'threads'.
+// This is much cheaper to read than smaps, but the kernel's rss counters are approximate.
+struct ProcStatus {
+    uint64_t vm_peak = 0;
+    uint64_t vm_size = 0;
+    uint64_t vm_lck = 0;
+    uint64_t vm_hwm = 0;
+    uint64_t vm_rss = 0;
+    uint64_t rss_anon = 0;
+    uint64_t rss_file = 0;
+    uint64_t rss_shmem = 0;
+    uint64_t vm_swap = 0;
+    uint64_t threads = 0;
+
+    // The fields that were found, e.g. kernel threads have no Vm* fields.
+    uint32_t fields = 0;
+};
+
+// Reads the 'fields' of the /proc/<pid>/status file open at 'fd' into 'status'. Other fields,
+// and those not in the file, are zeroed. The file is read with pread() from offset 0 into a
+// buffer on the stack, so the same fd can be read again for each sample of the process. Reading
+// stops as soon as all of 'fields' are found, usually after a single read.
+// Returns 'false' if reading fails, e.g. with ESRCH once the process is gone.
+bool ReadProcStatus(int fd, uint32_t fields, ProcStatus* status);
+
+// Same as above, for the file at 'path'.
+bool ProcStatusFromFile(const std::string& path, uint32_t fields, ProcStatus* status);
+
+}  // namespace meminfo
+}  // namespace android
@@ -0,0 +1,75 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <sys/types.h>
+
+#include <string>
+#include <unordered_map>
+
+#include <android-base/unique_fd.h>
+
+#include "meminfo.h"
+
+namespace android {
+namespace meminfo {
+
+// Reads /proc/<pid>/smaps_rollup (or smaps if the kernel has no rollup) of the same processes
+// over and over, as periodic Pss collection does:
+//
+//   RollupReader reader;
+//   for (;;) {
+//       for (pid_t pid : pids) reader.SmapsOrRollup(pid, &stats[pid]);
+//       sleep(interval);
+//   }
+//
+// The file of each pid is opened once and kept open. procfs regenerates it on every read from
+// offset 0, so a later call is a pread() into a buffer the reader keeps, without formatting
+// the path or opening and closing the file.
+//
+// An open file stays bound to the address space (mm) it was opened with, so reads fail with
+// ESRCH once the process exits, but also once it execs. On ESRCH the file is opened again, once,
+// so a process that exec'd is read as it is now. If that fails too, the process is gone: the
+// call returns false with errno set to ESRCH and drops the file. As with ProcMemInfo, a pid
+// that was reused in between reads as the new process.
+class RollupReader final {
+  public:
+    RollupReader() = default;
+    RollupReader(const RollupReader&) = delete;
+    RollupReader& operator=(const RollupReader&) = delete;
+
+    // Same as ProcMemInfo::SmapsOrRollup() and ProcMemInfo::SmapsOrRollupPss().
+    bool SmapsOrRollup(pid_t pid, MemUsage* stats);
+    bool SmapsOrRollupPss(pid_t pid, uint64_t* pss);
+
+    // Closes the file of 'pid', e.g. once it is known to be gone.
+    void Close(pid_t pid) { files_.erase(pid); }
+    // Closes all files.
+    void CloseAll() { files_.clear(); }
+    // Number of files open.
+    size_t size() const { return files_.size(); }
+
+  private:
+    // Reads the file of 'pid' into 'buffer_' and returns its size, or -1 on failure.
+    ssize_t Read(pid_t pid);
+
+    std::unordered_map<pid_t, ::android::base::unique_fd> files_;
+    std::string buffer_;
+};
+
+}  // namespace meminfo
+}  // namespace android
@@ -0,0 +1,100 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <sys/types.h>
+
+#include <span>
+#include <string>
+#include <vector>
+
+#include "meminfo.h"
+
+namespace android {
+namespace meminfo {
+
+// A vma whose usage changed between two snapshots.
+struct VmaChange {
+    // The vma, with its usage, as in the newer snapshot.
+    Vma vma;
+    // How much each counter grew and shrank since the older snapshot. At most one of the two is
+    // non-zero for any counter.
+    MemUsage grown;
+    MemUsage shrunk;
+};
+
+// Differences between two lists of vmas. Each list is in address order.
+struct VmaDelta {
+    // Vmas only in the newer list.
+    std::vector<Vma> added;
+    // Vmas only in the older list, with their usage as it was then.
+    std::vector<Vma> removed;
+    // Vmas in both lists whose usage changed. Vmas whose usage didn't change aren't listed.
+    std::vector<VmaChange> changed;
+
+    void clear() {
+        added.clear();
+        removed.clear();
+        changed.clear();
+    }
+};
+
+// Sets 'delta' to the differences from 'old' to 'cur', which must both be sorted by start
+// address, as smaps and maps are. A vma is the same in both if its start, end, inode, offset,
+// flags and name are. Runs in a single pass over both lists.
+void DiffVmas(std::span<const Vma> old, std::span<const Vma> cur, VmaDelta* delta);
+
+// Keeps the last parse of /proc/<pid>/smaps so that a collector sampling a process over and
+// over only needs to look at what changed:
+//
+//   SmapsSnapshot snapshot(pid);
+//   for (;;) {
+//       snapshot.Update(&delta);
+//       ... delta.added, delta.removed, delta.changed ...
+//       sleep(interval);
+//   }
+//
+// The first Update() reports every vma as added. The vmas of the last two snapshots are
+// kept and overwritten in place, so once their names have grown to fit, an update doesn't
+// allocate for vmas that are the same as in the snapshot before.
+class SmapsSnapshot final {
+  public:
+    explicit SmapsSnapshot(pid_t pid) : pid_(pid) {}
+
+    // Reads /proc/<pid>/smaps and, if 'delta' isn't null, sets it to the changes since the
+    // previous snapshot. Returns false and keeps the previous snapshot if reading fails.
+    bool Update(VmaDelta* delta);
+    // Same as above, for the smaps file at 'path'.
+    bool UpdateFromFile(const std::string& path, VmaDelta* delta);
+
+    // The vmas of the last snapshot, in address order.
+    const std::vector<Vma>& vmas() const { return vmas_; }
+
+    // Drops the last snapshot, so the next Update() reports every vma as added.
+    void Reset() { vmas_.clear(); }
+
+  private:
+    pid_t pid_;
+    std::vector<Vma> vmas_;
+    // The snapshot before vmas_, whose entries the next update overwrites.
+    std::vector<Vma> next_;
+    std::string path_;
+    std::string buffer_;
+};
+
+}  // namespace meminfo
+}  // namespace android
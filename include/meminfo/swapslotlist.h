@@ -0,0 +1,94 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <vector>
+
+namespace android {
+namespace meminfo {
+
+// The swap slots, i.e. (swap type, offset) pairs, used by the swapped out pages of a process.
+// Slots are grouped by swap type (the swap device or file), and the sorted offsets of each type
+// are stored as deltas in LEB128, so nearby slots take a byte or two instead of eight. A slot
+// is listed once for each page that uses it.
+class SwapSlotList final {
+  public:
+    // Packs a slot the way Assign() and Append() expect it. Sorting packed slots sorts them
+    // by type and then by offset.
+    static constexpr uint64_t Slot(uint32_t type, uint64_t offset) {
+        return (static_cast<uint64_t>(type) << kTypeShift) | offset;
+    }
+
+    // Replaces the list with the packed 'slots', which may be in any order and are sorted
+    // in place.
+    void Assign(std::vector<uint64_t>* slots);
+    // Adds the packed 'slots' to the list, which may be in any order and are sorted in place.
+    void Append(std::vector<uint64_t>* slots);
+
+    // Calls 'fn(type, offset)' for each slot, by type and then by offset.
+    template <typename Fn>
+    void ForEach(Fn fn) const {
+        for (const Run& run : runs_) {
+            const uint8_t* p = deltas_.data() + run.begin;
+            uint64_t offset = 0;
+            for (size_t i = 0; i < run.size; i++) {
+                uint64_t delta = 0;
+                for (int shift = 0;; shift += 7) {
+                    delta |= static_cast<uint64_t>(*p & 0x7f) << shift;
+                    if (!(*p++ & 0x80)) break;
+                }
+                offset += delta;
+                fn(run.type, offset);
+            }
+        }
+    }
+
+    // Returns the highest offset used for 'type', or -1 if there is none.
+    int64_t MaxOffset(uint32_t type) const;
+    // Returns the highest swap type used, or -1 if the list is empty.
+    int64_t MaxType() const { return runs_.empty() ? -1 : int64_t{runs_.back().type}; }
+
+    size_t size() const { return size_; }
+    bool empty() const { return size_ == 0; }
+    void clear() {
+        runs_.clear();
+        deltas_.clear();
+        size_ = 0;
+    }
+
+  private:
+    // PAGE_SWAP_OFFSET() is 50 bits wide.
+    static constexpr int kTypeShift = 50;
+
+    // The slots of one swap type, deltas_[begin] onwards.
+    struct Run {
+        uint32_t type;
+        size_t size;
+        size_t begin;
+        uint64_t max_offset;
+    };
+
+    std::vector<Run> runs_;
+    std::vector<uint8_t> deltas_;
+    size_t size_ = 0;
+};
+
+}  // namespace meminfo
+}  // namespace android
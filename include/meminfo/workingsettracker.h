@@ -0,0 +1,82 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <sys/types.h>
+
+#include <vector>
+
+#include "meminfo.h"
+
+namespace android {
+namespace meminfo {
+
+// Measures the working set of a process over an interval using idle page tracking
+// (CONFIG_IDLE_PAGE_TRACKING):
+//
+//   WorkingSetTracker tracker(pid);
+//   tracker.Arm();
+//   sleep(interval);
+//   tracker.Collect(&wss);
+//
+// Each Arm() walks /proc/<pid>/pagemap of every vma on purpose, also of vmas that didn't
+// change since the previous cycle. Pages may have been faulted in, reclaimed or migrated since,
+// and a page frame that was reclaimed may belong to another process by now. Telling whether
+// the frames recorded for a vma are still its own takes reading its page map anyway, so they
+// aren't reused. The page map is read through a single open file and buffer (see
+// ProcMemInfo::BeginSession()), and the lists of vmas and page frames keep their storage
+// between cycles.
+class WorkingSetTracker final {
+  public:
+    explicit WorkingSetTracker(pid_t pid) : pid_(pid), armed_(false) {}
+
+    // Reads the maps of the process, records the page frames of all present pages of each
+    // vma and marks them idle in bulk.
+    // Returns false if anything goes wrong.
+    bool Arm();
+
+    // Reads the idle bitmap once for all page frames recorded by the last Arm() and stores
+    // the vmas in 'wss', with the usage of the pages that were accessed since. As with
+    // ProcMemInfo's working set, vss is the same as rss. Page frames that were freed (and
+    // possibly reused) since Arm() may be accounted to the vma they were recorded for.
+    // Returns false if Arm() wasn't called first or anything goes wrong.
+    bool Collect(std::vector<Vma>* wss);
+
+    // Drops the recorded page frames and their storage.
+    void Reset() {
+        vmas_.clear();
+        vmas_.shrink_to_fit();
+        vma_pfns_.clear();
+        vma_pfns_.shrink_to_fit();
+        pfns_.clear();
+        pfns_.shrink_to_fit();
+        armed_ = false;
+    }
+
+  private:
+    pid_t pid_;
+    bool armed_;
+
+    // Vmas seen by the last Arm(), in address order. The page frames of vmas_[i] are
+    // pfns_[vma_pfns_[i]] to pfns_[vma_pfns_[i + 1]].
+    std::vector<Vma> vmas_;
+    std::vector<size_t> vma_pfns_;
+    std::vector<uint64_t> pfns_;
+};
+
+}  // namespace meminfo
+}  // namespace android
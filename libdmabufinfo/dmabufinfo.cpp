@@ -247,6 +247,11 @@ bool ReadDmaBufMapRefs(pid_t pid, std::vector<DmaBuffer>* dmabufs,
     };
 
     for (std::string line; getline(fp, line);) {
+        // Most mappings aren't dmabufs, so skip them before they are parsed into a MapInfo,
+        // which copies the name into a std::string.
+        if (line.find("/dmabuf") == std::string::npos) {
+            continue;
+        }
         if (!::android::procinfo::ReadMapFileContent(line.data(), account_dmabuf)) {
             LOG(ERROR) << "Failed to parse " << mapspath << " for pid: " << pid;
             return false;
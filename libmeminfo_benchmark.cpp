@@ -14,30 +14,58 @@
  * limitations under the License.
  */
 
+#include <meminfo/pageacct.h>
 #include <meminfo/procmeminfo.h>
+#include <meminfo/procstatus.h>
+#include <meminfo/rollupreader.h>
+#include <meminfo/smapssnapshot.h>
 #include <meminfo/sysmeminfo.h>
 
+#include <dirent.h>
 #include <fcntl.h>
 #include <inttypes.h>
 #include <stdio.h>
+#include <string.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <unistd.h>
 
+#include <algorithm>
+#include <memory>
 #include <string>
+#include <utility>
+#include <vector>
 
 #include <android-base/file.h>
 #include <android-base/logging.h>
+#include <android-base/parseint.h>
 #include <android-base/stringprintf.h>
 #include <android-base/unique_fd.h>
+#include <procinfo/process_map.h>
 
 #include <benchmark/benchmark.h>
 
+using ::android::meminfo::ForEachVmaFromFile;
+using ::android::meminfo::ForEachVmaViewFromFile;
 using ::android::meminfo::MemUsage;
+using ::android::meminfo::PageAcct;
 using ::android::meminfo::ProcMemInfo;
+using ::android::meminfo::ProcStatus;
+using ::android::meminfo::ProcStatusFromFile;
+using ::android::meminfo::ReadProcStatus;
+using ::android::meminfo::RollupReader;
+using ::android::meminfo::SmapsSnapshot;
+using ::android::meminfo::SmapsOrRollupBatchOptions;
 using ::android::meminfo::SmapsOrRollupFromFile;
+using ::android::meminfo::SmapsOrRollupPssFromFile;
 using ::android::meminfo::SysMemInfo;
 using ::android::meminfo::Vma;
+using ::android::meminfo::VmaCallback;
+using ::android::meminfo::VmaDelta;
+using ::android::meminfo::VmaView;
+using ::android::meminfo::kStatusVmHWM;
+using ::android::meminfo::kStatusVmRSS;
+using ::android::meminfo::kStatusVmSwap;
 
 enum {
     MEMINFO_TOTAL,
@@ -546,6 +574,409 @@ static void BM_SmapsRollup_new(benchmark::State& state) {
 }
 BENCHMARK(BM_SmapsRollup_new);
 
+static void BM_PeriodicRollup_old(benchmark::State& state) {
+    ProcMemInfo proc_mem(getpid());
+    for (auto _ : state) {
+        MemUsage stats;
+        CHECK_EQ(proc_mem.SmapsOrRollup(&stats), true);
+    }
+}
+BENCHMARK(BM_PeriodicRollup_old);
+
+static void BM_PeriodicRollup_new(benchmark::State& state) {
+    RollupReader reader;
+    for (auto _ : state) {
+        MemUsage stats;
+        CHECK_EQ(reader.SmapsOrRollup(getpid(), &stats), true);
+    }
+}
+BENCHMARK(BM_PeriodicRollup_new);
+
+// The pids of all processes, as periodic Pss collection reads them.
+static std::vector<pid_t> all_pids() {
+    std::vector<pid_t> pids;
+    std::unique_ptr<DIR, decltype(&closedir)> dir(opendir("/proc"), closedir);
+    CHECK(dir != nullptr);
+    while (struct dirent* entry = readdir(dir.get())) {
+        pid_t pid;
+        if (::android::base::ParseInt(entry->d_name, &pid, 1)) {
+            pids.push_back(pid);
+        }
+    }
+    return pids;
+}
+
+static void BM_SmapsOrRollupAll_old(benchmark::State& state) {
+    std::vector<pid_t> pids = all_pids();
+    std::vector<MemUsage> stats(pids.size());
+    for (auto _ : state) {
+        for (size_t i = 0; i < pids.size(); i++) {
+            ProcMemInfo(pids[i]).SmapsOrRollup(&stats[i]);
+        }
+    }
+}
+BENCHMARK(BM_SmapsOrRollupAll_old);
+
+static void BM_SmapsOrRollupAll_new(benchmark::State& state) {
+    std::vector<pid_t> pids = all_pids();
+    std::vector<MemUsage> stats(pids.size());
+    SmapsOrRollupBatchOptions options = {.num_threads = static_cast<uint32_t>(state.range(0))};
+    for (auto _ : state) {
+        ProcMemInfo::SmapsOrRollupBatch(pids, stats, {}, options);
+    }
+}
+BENCHMARK(BM_SmapsOrRollupAll_new)->Arg(1)->Arg(4)->Arg(8)->UseRealTime();
+
+// SmapsOrRollupPssFromFile() before it only parsed the Pss lines, picked up as-is.
+static bool smaps_or_rollup_pss_old(const std::string& path, uint64_t* pss) {
+    auto fp = std::unique_ptr<FILE, decltype(&fclose)>{fopen(path.c_str(), "re"), fclose};
+    if (fp == nullptr) {
+        return false;
+    }
+    *pss = 0;
+    char* line = nullptr;
+    size_t line_alloc = 0;
+    while (getline(&line, &line_alloc, fp.get()) > 0) {
+        uint64_t v;
+        if (sscanf(line, "Pss: %" SCNu64 " kB", &v) == 1) {
+            *pss += v;
+        }
+    }
+
+    // free getline() managed buffer
+    free(line);
+    return true;
+}
+
+static void BM_SmapsOrRollupPss_old(benchmark::State& state) {
+    std::string exec_dir = ::android::base::GetExecutableDirectory();
+    std::string path = ::android::base::StringPrintf("%s/testdata1/smaps", exec_dir.c_str());
+    for (auto _ : state) {
+        uint64_t pss;
+        CHECK_EQ(smaps_or_rollup_pss_old(path, &pss), true);
+        CHECK_EQ(pss, 108384);
+    }
+}
+BENCHMARK(BM_SmapsOrRollupPss_old);
+
+static void BM_SmapsOrRollupPss_new(benchmark::State& state) {
+    std::string exec_dir = ::android::base::GetExecutableDirectory();
+    std::string path = ::android::base::StringPrintf("%s/testdata1/smaps", exec_dir.c_str());
+    for (auto _ : state) {
+        uint64_t pss;
+        CHECK_EQ(SmapsOrRollupPssFromFile(path, &pss), true);
+        CHECK_EQ(pss, 108384);
+    }
+}
+BENCHMARK(BM_SmapsOrRollupPss_new);
+
+// StatusVmRSSFromFile() before ProcStatus, generalized to any field, picked up as-is.
+static bool status_field_old(const std::string& path, const char* format, uint64_t* value) {
+    auto fp = std::unique_ptr<FILE, decltype(&fclose)>{fopen(path.c_str(), "re"), fclose};
+    if (fp == nullptr) {
+        return false;
+    }
+
+    bool success = false;
+
+    *value = 0;
+    char* line = nullptr;
+    size_t line_alloc = 0;
+    while (getline(&line, &line_alloc, fp.get()) > 0) {
+        uint64_t v;
+        if (sscanf(line, format, &v) == 1) {
+            *value = v;
+            success = true;
+            break;
+        }
+    }
+
+    // free getline() managed buffer
+    free(line);
+    return success;
+}
+
+// A collector reading rss, hwm and swap, one field at a time.
+static void BM_ProcStatus_old(benchmark::State& state) {
+    std::string exec_dir = ::android::base::GetExecutableDirectory();
+    std::string path = ::android::base::StringPrintf("%s/testdata1/status", exec_dir.c_str());
+    for (auto _ : state) {
+        uint64_t rss, hwm, swap;
+        CHECK_EQ(status_field_old(path, "VmRSS: %" SCNu64 " kB", &rss), true);
+        CHECK_EQ(status_field_old(path, "VmHWM: %" SCNu64 " kB", &hwm), true);
+        CHECK_EQ(status_field_old(path, "VmSwap: %" SCNu64 " kB", &swap), true);
+        CHECK_EQ(rss, 730764);
+    }
+}
+BENCHMARK(BM_ProcStatus_old);
+
+static void BM_ProcStatus_new(benchmark::State& state) {
+    std::string exec_dir = ::android::base::GetExecutableDirectory();
+    std::string path = ::android::base::StringPrintf("%s/testdata1/status", exec_dir.c_str());
+    for (auto _ : state) {
+        ProcStatus status;
+        CHECK_EQ(ProcStatusFromFile(path, kStatusVmRSS | kStatusVmHWM | kStatusVmSwap, &status),
+                 true);
+        CHECK_EQ(status.vm_rss, 730764);
+    }
+}
+BENCHMARK(BM_ProcStatus_new);
+
+// Same as BM_ProcStatus_new, sampling a live process through a kept fd.
+static void BM_ProcStatus_new_fd(benchmark::State& state) {
+    ::android::base::unique_fd fd(
+            TEMP_FAILURE_RETRY(open("/proc/self/status", O_RDONLY | O_CLOEXEC)));
+    CHECK(fd != -1);
+    for (auto _ : state) {
+        ProcStatus status;
+        CHECK_EQ(ReadProcStatus(fd, kStatusVmRSS | kStatusVmHWM | kStatusVmSwap, &status), true);
+    }
+}
+BENCHMARK(BM_ProcStatus_new_fd);
+
+// wsstop's diff of two samples before DiffVmas(), picked up as-is.
+static bool same_vma_old(const Vma& cur, const Vma& last) {
+    return (cur.start == last.start && cur.end == last.end && cur.name == last.name &&
+            cur.flags == last.flags && cur.offset == last.offset);
+}
+
+static Vma diff_vma_params_old(const Vma& cur, const Vma& last) {
+    Vma res;
+    res.usage = cur.usage;
+    res.usage.SaturatingSub(last.usage);
+
+    // set vma properties to the same as the current one.
+    res.start = cur.start;
+    res.end = cur.end;
+    res.offset = cur.offset;
+    res.flags = cur.flags;
+    res.name = cur.name;
+    return res;
+}
+
+static void diff_workingset_old(std::vector<Vma>& wss, std::vector<Vma>& old,
+                                std::vector<Vma>* res) {
+    res->clear();
+    auto vma_sorter = [](const Vma& a, const Vma& b) { return a.start < b.start; };
+    std::sort(wss.begin(), wss.end(), vma_sorter);
+    std::sort(old.begin(), old.end(), vma_sorter);
+    if (old.empty()) {
+        *res = wss;
+        return;
+    }
+
+    for (auto& i : wss) {
+        bool found_same_vma = false;
+        for (auto& j : old) {
+            if (same_vma_old(i, j)) {
+                res->emplace_back(diff_vma_params_old(i, j));
+                found_same_vma = true;
+                break;
+            }
+        }
+
+        if (!found_same_vma) {
+            res->emplace_back(i);
+        }
+    }
+
+    std::sort(res->begin(), res->end(), vma_sorter);
+}
+
+// Sampling system_server's smaps, 2760 vmas, and diffing it with the previous sample.
+static void BM_SmapsDiff_old(benchmark::State& state) {
+    std::string exec_dir = ::android::base::GetExecutableDirectory();
+    std::string path = ::android::base::StringPrintf("%s/testdata1/smaps", exec_dir.c_str());
+    std::vector<Vma> last;
+    std::vector<Vma> diff;
+    for (auto _ : state) {
+        std::vector<Vma> vmas;
+        CHECK_EQ(ForEachVmaFromFile(path,
+                                    [&](Vma& vma) {
+                                        vmas.emplace_back(vma);
+                                        return true;
+                                    }),
+                 true);
+        diff_workingset_old(vmas, last, &diff);
+        last = std::move(vmas);
+    }
+}
+BENCHMARK(BM_SmapsDiff_old);
+
+static void BM_SmapsDiff_new(benchmark::State& state) {
+    std::string exec_dir = ::android::base::GetExecutableDirectory();
+    std::string path = ::android::base::StringPrintf("%s/testdata1/smaps", exec_dir.c_str());
+    SmapsSnapshot snapshot(getpid());
+    VmaDelta delta;
+    for (auto _ : state) {
+        CHECK_EQ(snapshot.UpdateFromFile(path, &delta), true);
+    }
+}
+BENCHMARK(BM_SmapsDiff_new);
+
+// The smaps parser ForEachVmaFromFile() used before it moved to ForEachVmaViewFromFile(),
+// picked up as-is.
+static bool parse_smaps_field_old(const char* line, MemUsage* stats) {
+    const char* end = line;
+
+    // https://lore.kernel.org/patchwork/patch/1088579/ introduced tabs. Handle this case as well.
+    while (*end && !isspace(*end)) end++;
+    if (*end && end > line && *(end - 1) == ':') {
+        const char* c = end;
+        while (isspace(*c)) c++;
+        switch (line[0]) {
+            case 'P':
+                if (strncmp(line, "Pss:", 4) == 0) {
+                    stats->pss = strtoull(c, nullptr, 10);
+                } else if (strncmp(line, "Private_Clean:", 14) == 0) {
+                    uint64_t prcl = strtoull(c, nullptr, 10);
+                    stats->private_clean = prcl;
+                    stats->uss += prcl;
+                } else if (strncmp(line, "Private_Dirty:", 14) == 0) {
+                    uint64_t prdi = strtoull(c, nullptr, 10);
+                    stats->private_dirty = prdi;
+                    stats->uss += prdi;
+                } else if (strncmp(line, "Private_Hugetlb:", 16) == 0) {
+                    stats->private_hugetlb = strtoull(c, nullptr, 10);
+                }
+                break;
+            case 'S':
+                if (strncmp(line, "Size:", 5) == 0) {
+                    stats->vss = strtoull(c, nullptr, 10);
+                } else if (strncmp(line, "Shared_Clean:", 13) == 0) {
+                    stats->shared_clean = strtoull(c, nullptr, 10);
+                } else if (strncmp(line, "Shared_Dirty:", 13) == 0) {
+                    stats->shared_dirty = strtoull(c, nullptr, 10);
+                } else if (strncmp(line, "Swap:", 5) == 0) {
+                    stats->swap = strtoull(c, nullptr, 10);
+                } else if (strncmp(line, "SwapPss:", 8) == 0) {
+                    stats->swap_pss = strtoull(c, nullptr, 10);
+                } else if (strncmp(line, "ShmemPmdMapped:", 15) == 0) {
+                    stats->shmem_pmd_mapped = strtoull(c, nullptr, 10);
+                } else if (strncmp(line, "Shared_Hugetlb:", 15) == 0) {
+                    stats->shared_hugetlb = strtoull(c, nullptr, 10);
+                }
+                break;
+            case 'R':
+                if (strncmp(line, "Rss:", 4) == 0) {
+                    stats->rss = strtoull(c, nullptr, 10);
+                }
+                break;
+            case 'A':
+                if (strncmp(line, "AnonHugePages:", 14) == 0) {
+                    stats->anon_huge_pages = strtoull(c, nullptr, 10);
+                }
+                break;
+            case 'F':
+                if (strncmp(line, "FilePmdMapped:", 14) == 0) {
+                    stats->file_pmd_mapped = strtoull(c, nullptr, 10);
+                }
+                break;
+            case 'L':
+                if (strncmp(line, "Locked:", 7) == 0) {
+                    stats->locked = strtoull(c, nullptr, 10);
+                }
+                break;
+        }
+        return true;
+    }
+
+    return false;
+}
+
+static bool for_each_vma_from_file_old(const std::string& path, const VmaCallback& callback) {
+    auto fp = std::unique_ptr<FILE, decltype(&fclose)>{fopen(path.c_str(), "re"), fclose};
+    if (fp == nullptr) {
+        return false;
+    }
+
+    char* line = nullptr;
+    bool parsing_vma = false;
+    ssize_t line_len;
+    size_t line_alloc = 0;
+    Vma vma;
+    while ((line_len = getline(&line, &line_alloc, fp.get())) > 0) {
+        // Make sure the line buffer terminates like a C string for ReadMapFile
+        line[line_len] = '\0';
+
+        if (parsing_vma) {
+            if (parse_smaps_field_old(line, &vma.usage)) {
+                // This was a stats field
+                continue;
+            }
+
+            // Done collecting stats, make the call back
+            if (!callback(vma)) {
+                free(line);
+                return false;
+            }
+            parsing_vma = false;
+        }
+
+        vma.clear();
+        // If it has, we are looking for the vma stats
+        // 00400000-00409000 r-xp 00000000 fc:00 426998  /usr/lib/gvfs/gvfsd-http
+        if (!::android::procinfo::ReadMapFileContent(
+                    line, [&](const android::procinfo::MapInfo& mapinfo) {
+                        vma.start = mapinfo.start;
+                        vma.end = mapinfo.end;
+                        vma.flags = mapinfo.flags;
+                        vma.offset = mapinfo.pgoff;
+                        vma.name = mapinfo.name;
+                        vma.inode = mapinfo.inode;
+                        vma.is_shared = mapinfo.shared;
+                    })) {
+            // free getline() managed buffer
+            free(line);
+            LOG(ERROR) << "Failed to parse " << path;
+            return false;
+        }
+        parsing_vma = true;
+    }
+
+    // free getline() managed buffer
+    free(line);
+
+    if (parsing_vma) {
+        if (!callback(vma)) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+static void BM_SmapsParsing_old(benchmark::State& state) {
+    std::string exec_dir = ::android::base::GetExecutableDirectory();
+    std::string path = ::android::base::StringPrintf("%s/testdata1/smaps", exec_dir.c_str());
+    for (auto _ : state) {
+        uint64_t pss = 0;
+        auto sum_pss = [&](const Vma& vma) {
+            pss += vma.usage.pss;
+            return true;
+        };
+        CHECK_EQ(for_each_vma_from_file_old(path, sum_pss), true);
+        CHECK_EQ(pss, 108384);
+    }
+}
+BENCHMARK(BM_SmapsParsing_old);
+
+static void BM_SmapsParsing_new(benchmark::State& state) {
+    std::string exec_dir = ::android::base::GetExecutableDirectory();
+    std::string path = ::android::base::StringPrintf("%s/testdata1/smaps", exec_dir.c_str());
+    std::string buffer;
+    for (auto _ : state) {
+        uint64_t pss = 0;
+        auto sum_pss = [&](const VmaView& vma) {
+            pss += vma.usage.pss;
+            return true;
+        };
+        CHECK_EQ(ForEachVmaViewFromFile(path, sum_pss, true, &buffer), true);
+        CHECK_EQ(pss, 108384);
+    }
+}
+BENCHMARK(BM_SmapsParsing_new);
+
 static void BM_MapsVmaParsing_ForEachVmaFromMaps(benchmark::State& state) {
     state.PauseTiming();
     int pid = getpid();
@@ -588,4 +1019,96 @@ static void BM_MapsVmaParsing_ForEachVma(benchmark::State& state) {
 }
 BENCHMARK(BM_MapsVmaParsing_ForEachVma)->Unit(benchmark::kMillisecond);
 
+// Returns the page frames of all resident pages of the calling process, in the order they
+// appear in its address space.
+static std::vector<uint64_t> get_self_page_frames() {
+    std::vector<uint64_t> pfns;
+    ProcMemInfo meminfo(getpid());
+    meminfo.ForEachPageMapChunk(meminfo.MapsWithoutUsageStats(),
+                                [&](std::span<const uint64_t> entries, uint64_t) {
+                                    for (uint64_t page_info : entries) {
+                                        if (::android::meminfo::page_present(page_info)) {
+                                            pfns.emplace_back(
+                                                    ::android::meminfo::page_pfn(page_info));
+                                        }
+                                    }
+                                    return true;
+                                });
+    return pfns;
+}
+
+static void BM_PageAttrs_PerPage(benchmark::State& state) {
+    std::vector<uint64_t> pfns = get_self_page_frames();
+    PageAcct& pinfo = PageAcct::Instance();
+    for (auto _ : state) {
+        for (uint64_t pfn : pfns) {
+            uint64_t flags, count;
+            CHECK(pinfo.PageFlags(pfn, &flags));
+            CHECK(pinfo.PageMapCount(pfn, &count));
+        }
+    }
+    state.SetItemsProcessed(state.iterations() * pfns.size());
+}
+BENCHMARK(BM_PageAttrs_PerPage);
+
+static void BM_PageAttrs_Resolver(benchmark::State& state) {
+    std::vector<uint64_t> pfns = get_self_page_frames();
+    std::vector<uint64_t> flags(pfns.size());
+    std::vector<uint64_t> counts(pfns.size());
+    PageAcct& pinfo = PageAcct::Instance();
+    for (auto _ : state) {
+        CHECK(pinfo.PageFlagsBatch(pfns, flags));
+        CHECK(pinfo.PageMapCountBatch(pfns, counts));
+    }
+    state.SetItemsProcessed(state.iterations() * pfns.size());
+}
+BENCHMARK(BM_PageAttrs_Resolver);
+
+static std::vector<uint64_t> get_self_page_map() {
+    std::vector<uint64_t> entries;
+    ProcMemInfo meminfo(getpid());
+    meminfo.ForEachPageMapChunk(meminfo.MapsWithoutUsageStats(),
+                                [&](std::span<const uint64_t> chunk, uint64_t) {
+                                    entries.insert(entries.end(), chunk.begin(), chunk.end());
+                                    return true;
+                                });
+    return entries;
+}
+
+static void BM_PageMapClassify_Scalar(benchmark::State& state) {
+    std::vector<uint64_t> entries = get_self_page_map();
+    std::vector<uint64_t> pfns(entries.size());
+    for (auto _ : state) {
+        size_t nr_present = 0;
+        size_t nr_swapped = 0;
+        for (uint64_t page_info : entries) {
+            if (::android::meminfo::page_swapped(page_info)) {
+                nr_swapped++;
+            } else if (::android::meminfo::page_present(page_info)) {
+                pfns[nr_present++] = ::android::meminfo::page_pfn(page_info);
+            }
+        }
+        benchmark::DoNotOptimize(nr_present);
+        benchmark::DoNotOptimize(nr_swapped);
+    }
+    state.SetItemsProcessed(state.iterations() * entries.size());
+}
+BENCHMARK(BM_PageMapClassify_Scalar);
+
+static void BM_PageMapClassify_Vector(benchmark::State& state) {
+    std::vector<uint64_t> entries = get_self_page_map();
+    std::vector<uint64_t> present_mask((entries.size() + 63) / 64);
+    std::vector<uint64_t> swapped_mask(present_mask.size());
+    std::vector<uint64_t> pfns(entries.size());
+    for (auto _ : state) {
+        size_t nr_present, nr_swapped;
+        CHECK(::android::meminfo::ClassifyPageMap(entries, present_mask, swapped_mask, pfns,
+                                                  &nr_present, &nr_swapped));
+        benchmark::DoNotOptimize(nr_present);
+        benchmark::DoNotOptimize(nr_swapped);
+    }
+    state.SetItemsProcessed(state.iterations() * entries.size());
+}
+BENCHMARK(BM_PageMapClassify_Vector);
+
 BENCHMARK_MAIN();
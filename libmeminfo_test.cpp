@@ -14,6 +14,11 @@
  * limitations under the License.
  */
 
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/kernel-page-flags.h>
+#include <signal.h>
+#include <string.h>
 #include <sys/mman.h>
 #include <sys/types.h>
 #include <sys/wait.h>
@@ -21,14 +26,20 @@
 
 #include <gtest/gtest.h>
 
+#include <chrono>
 #include <filesystem>
+#include <span>
 #include <string>
 #include <vector>
 
 #include <meminfo/androidprocheaps.h>
 #include <meminfo/pageacct.h>
 #include <meminfo/procmeminfo.h>
+#include <meminfo/procstatus.h>
+#include <meminfo/rollupreader.h>
+#include <meminfo/smapssnapshot.h>
 #include <meminfo/sysmeminfo.h>
+#include <meminfo/workingsettracker.h>
 #include <vintf/VintfObject.h>
 
 #include <android-base/file.h>
@@ -36,6 +47,7 @@
 #include <android-base/properties.h>
 #include <android-base/stringprintf.h>
 #include <android-base/strings.h>
+#include <android-base/unique_fd.h>
 
 using namespace std;
 using namespace android::meminfo;
@@ -162,6 +174,160 @@ TEST(ProcMemInfo, MapsUsageFillInAll) {
     }
 }
 
+TEST(ProcMemInfo, MapsUsageFillInAllParallel) {
+    ProcMemInfo serial_mem(pid);
+    const std::vector<Vma>& serial_maps = serial_mem.MapsWithoutUsageStats();
+    ASSERT_FALSE(serial_maps.empty());
+    ASSERT_TRUE(serial_mem.GetUsageStats(false));
+
+    ProcMemInfo parallel_mem(pid);
+    parallel_mem.SetUsageStatsThreads(4);
+    const std::vector<Vma>& parallel_maps = parallel_mem.MapsWithoutUsageStats();
+    ASSERT_TRUE(parallel_mem.GetUsageStats(false));
+
+    // Resident pages may come and go between the two walks, but the layout must match.
+    ASSERT_EQ(serial_maps.size(), parallel_maps.size());
+    uint64_t total_rss = 0;
+    for (size_t i = 0; i < serial_maps.size(); i++) {
+        ASSERT_EQ(serial_maps[i].start, parallel_maps[i].start);
+        ASSERT_EQ(serial_maps[i].usage.vss, parallel_maps[i].usage.vss);
+        total_rss += parallel_maps[i].usage.rss;
+    }
+    EXPECT_EQ(serial_mem.Usage().vss, parallel_mem.Usage().vss);
+    EXPECT_NE(0, total_rss);
+}
+
+TEST(ProcMemInfo, UsageFromPageMap) {
+    ProcMemInfo proc_mem(pid);
+    ASSERT_FALSE(proc_mem.MapsWithoutUsageStats().empty());
+
+    MemUsage fast;
+    ASSERT_TRUE(proc_mem.UsageFromPageMap(&fast));
+    EXPECT_NE(0, fast.rss);
+    EXPECT_LE(fast.uss, fast.rss);
+    EXPECT_EQ(0, fast.pss);
+    EXPECT_EQ(0, fast.private_clean + fast.private_dirty + fast.shared_clean + fast.shared_dirty);
+
+    MemUsage with_flags;
+    ASSERT_TRUE(proc_mem.UsageFromPageMap(&with_flags, true));
+    EXPECT_EQ(with_flags.vss, fast.vss);
+    EXPECT_EQ(with_flags.uss, with_flags.private_clean + with_flags.private_dirty);
+    EXPECT_EQ(with_flags.rss, with_flags.uss + with_flags.shared_clean + with_flags.shared_dirty);
+
+    // Pages may be faulted in or out between the walks, so only expect the totals to be close.
+    ASSERT_TRUE(proc_mem.GetUsageStats(false));
+    const MemUsage& usage = proc_mem.Usage();
+    EXPECT_EQ(usage.vss, fast.vss);
+    EXPECT_NEAR(usage.rss, fast.rss, usage.rss / 20);
+    EXPECT_NEAR(usage.uss, fast.uss, usage.uss / 20);
+}
+
+TEST(ProcMemInfo, SessionMatchesOneShot) {
+    ProcMemInfo proc_mem(pid);
+    const std::vector<Vma>& maps = proc_mem.MapsWithoutUsageStats();
+    ASSERT_FALSE(maps.empty());
+
+    // A tiny buffer makes every vma take several reads.
+    ASSERT_TRUE(proc_mem.BeginSession(16 * sizeof(uint64_t)));
+    EXPECT_FALSE(proc_mem.BeginSession());
+    std::vector<uint64_t> session_pagemap;
+    std::vector<uint64_t> pagemap;
+    for (const Vma& map : maps) {
+        Vma vma = map;
+        Vma session_vma = map;
+        ASSERT_TRUE(proc_mem.FillInVmaStats(session_vma, true));
+        EXPECT_EQ(vma.end - vma.start, session_vma.usage.vss * 1024) << vma.name;
+        ASSERT_TRUE(proc_mem.PageMap(vma, &session_pagemap));
+        EXPECT_EQ((vma.end - vma.start) / getpagesize(), session_pagemap.size());
+    }
+    proc_mem.EndSession();
+
+    // Without a session everything still works, and a new session can be started.
+    ASSERT_TRUE(proc_mem.PageMap(maps.front(), &pagemap));
+    ASSERT_TRUE(proc_mem.BeginSession());
+    ASSERT_TRUE(proc_mem.GetUsageStats(false));
+    EXPECT_NE(0, proc_mem.Usage().rss);
+}
+
+TEST(ProcMemInfo, PageMapReturnsRawEntries) {
+    // Entries of pages that aren't populated are returned as the kernel reports them, e.g.
+    // with the soft-dirty bit of a new vma, not zeroed.
+    static constexpr size_t kNumPages = 64;
+    size_t pagesize = getpagesize();
+    void* ptr = mmap(nullptr, pagesize * kNumPages, PROT_READ | PROT_WRITE,
+                     MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    ASSERT_NE(MAP_FAILED, ptr);
+    uintptr_t addr = reinterpret_cast<uintptr_t>(ptr);
+    volatile uint8_t* data = reinterpret_cast<volatile uint8_t*>(addr);
+    for (size_t i = 0; i < kNumPages; i += 4) {
+        data[i * pagesize] = 1;
+    }
+
+    Vma vma(addr, addr + pagesize * kNumPages, 0, PROT_READ | PROT_WRITE, "", 0, false);
+    ProcMemInfo proc_mem(getpid());
+    std::vector<uint64_t> pagemap;
+    ASSERT_TRUE(proc_mem.PageMap(vma, &pagemap));
+    ASSERT_EQ(kNumPages, pagemap.size());
+
+    android::base::unique_fd fd(open("/proc/self/pagemap", O_RDONLY | O_CLOEXEC));
+    ASSERT_NE(-1, fd);
+    std::vector<uint64_t> raw(kNumPages);
+    ASSERT_EQ(static_cast<ssize_t>(kNumPages * sizeof(uint64_t)),
+              pread64(fd, raw.data(), kNumPages * sizeof(uint64_t),
+                      addr / pagesize * sizeof(uint64_t)));
+    EXPECT_EQ(raw, pagemap);
+
+    ASSERT_EQ(0, munmap(ptr, pagesize * kNumPages));
+}
+
+TEST(ProcMemInfo, SoftDirtyWss) {
+    if (!ProcMemInfo::KernelHasSoftDirty()) {
+        // The write working set must not silently read as empty.
+        pid_t pids[] = {getpid()};
+        MemUsage wss[1];
+        EXPECT_FALSE(ProcMemInfo::ResetSoftDirty(pids[0]));
+        EXPECT_FALSE(ProcMemInfo::SoftDirtyWss(pids, wss));
+        GTEST_SKIP() << "Soft-dirty tracking is not supported by the kernel";
+    }
+
+    static constexpr size_t kNumPages = 64;
+    size_t pagesize = getpagesize();
+    void* ptr = mmap(nullptr, pagesize * kNumPages, PROT_READ | PROT_WRITE,
+                     MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE, -1, 0);
+    ASSERT_NE(MAP_FAILED, ptr);
+    uintptr_t addr = reinterpret_cast<uintptr_t>(ptr);
+
+    pid_t self = getpid();
+    ASSERT_TRUE(ProcMemInfo::ResetSoftDirty(self));
+    volatile uint8_t* data = reinterpret_cast<volatile uint8_t*>(addr);
+    for (size_t i = 0; i < kNumPages; i += 2) {
+        data[i * pagesize] = 1;
+    }
+
+    ProcMemInfo proc_mem(self, true);
+    std::vector<uint64_t> pagemap;
+    Vma test_vma(addr, addr + kNumPages * pagesize, 0, PROT_READ | PROT_WRITE, "", 0, false);
+    ASSERT_TRUE(proc_mem.PageMap(test_vma, &pagemap));
+    EXPECT_TRUE(android::meminfo::page_soft_dirty(pagemap[0]));
+
+    const std::vector<Vma>& maps = proc_mem.MapsWithSoftDirty();
+    auto vma = std::find_if(maps.begin(), maps.end(),
+                            [addr](const Vma& v) { return v.start <= addr && addr < v.end; });
+    ASSERT_NE(maps.end(), vma);
+    // Neighbouring anonymous mappings may have been merged with the test one.
+    EXPECT_GE(vma->usage.rss, kNumPages / 2 * pagesize / 1024);
+    EXPECT_EQ(vma->usage.vss, vma->usage.rss);
+    EXPECT_GE(proc_mem.Wss().rss, vma->usage.rss);
+
+    std::vector<pid_t> pids = {self, self};
+    std::vector<MemUsage> wss(pids.size());
+    ASSERT_TRUE(ProcMemInfo::SoftDirtyWss(pids, wss));
+    EXPECT_GE(wss[0].rss, kNumPages / 2 * pagesize / 1024);
+    EXPECT_GE(wss[1].rss, kNumPages / 2 * pagesize / 1024);
+
+    ASSERT_EQ(0, munmap(ptr, pagesize * kNumPages));
+}
+
 TEST(ProcMemInfo, PageMapPresent) {
     static constexpr size_t kNumPages = 20;
     size_t pagesize = getpagesize();
@@ -220,6 +386,362 @@ TEST(ProcMemInfo, PageMapPresent) {
     ASSERT_EQ(0, munmap(reinterpret_cast<void*>(addr), kNumPages * pagesize));
 }
 
+TEST(ProcMemInfo, PageMapChunks) {
+    static constexpr size_t kNumPages = 40;
+    size_t pagesize = getpagesize();
+    void* ptr = mmap(nullptr, pagesize * kNumPages, PROT_READ | PROT_WRITE,
+                     MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    ASSERT_NE(MAP_FAILED, ptr);
+    uintptr_t addr = reinterpret_cast<uintptr_t>(ptr);
+    uint8_t* data = reinterpret_cast<uint8_t*>(addr);
+    for (size_t i = 0; i < kNumPages; i += 3) {
+        data[i * pagesize] = 1;
+    }
+
+    // Two abutting vmas, which are read together.
+    Vma first(addr, addr + 15 * pagesize, 0, PROT_READ | PROT_WRITE, "", 0, false);
+    Vma second(addr + 15 * pagesize, addr + kNumPages * pagesize, 0, PROT_READ | PROT_WRITE, "",
+               0, false);
+    std::vector<Vma> vmas = {first, second};
+
+    ProcMemInfo proc_mem(getpid());
+    std::vector<uint64_t> chunk_buffer(16);
+    std::vector<uint64_t> entries;
+    uint64_t next_vaddr = addr;
+    ASSERT_TRUE(proc_mem.ForEachPageMapChunk(
+            vmas,
+            [&](std::span<const uint64_t> chunk, uint64_t first_vaddr) {
+                EXPECT_EQ(next_vaddr, first_vaddr);
+                EXPECT_LE(chunk.size(), chunk_buffer.size());
+                entries.insert(entries.end(), chunk.begin(), chunk.end());
+                next_vaddr = first_vaddr + chunk.size() * pagesize;
+                return true;
+            },
+            chunk_buffer));
+    ASSERT_EQ(kNumPages, entries.size());
+    for (size_t i = 0; i < kNumPages; i++) {
+        EXPECT_EQ(i % 3 == 0, android::meminfo::page_present(entries[i])) << "Page " << i;
+    }
+
+    // The internal buffer is used without one, and the walk stops when the callback says so.
+    size_t nr_chunks = 0;
+    EXPECT_FALSE(proc_mem.ForEachPageMapChunk(first, [&](std::span<const uint64_t>, uint64_t) {
+        nr_chunks++;
+        return false;
+    }));
+    EXPECT_EQ(1, nr_chunks);
+
+    ASSERT_EQ(0, munmap(ptr, pagesize * kNumPages));
+}
+
+TEST(ProcMemInfo, HugePageUsage) {
+    // One page table worth of pages, the size of a PMD mapped transparent huge page.
+    size_t pagesize = getpagesize();
+    size_t hugesize = pagesize * (pagesize / sizeof(uint64_t));
+    void* ptr = mmap(nullptr, hugesize * 2, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS,
+                     -1, 0);
+    ASSERT_NE(MAP_FAILED, ptr);
+
+    // Keep a single aligned huge page worth of the map, so it's in a map by itself.
+    uintptr_t start = reinterpret_cast<uintptr_t>(ptr);
+    uintptr_t addr = (start + hugesize - 1) & ~(hugesize - 1);
+    if (addr > start) {
+        ASSERT_EQ(0, munmap(ptr, addr - start));
+    }
+    if (start + hugesize * 2 > addr + hugesize) {
+        ASSERT_EQ(0, munmap(reinterpret_cast<void*>(addr + hugesize),
+                            start + hugesize * 2 - addr - hugesize));
+    }
+
+    // THP may be disabled, in which case the pages are accounted one by one.
+    madvise(reinterpret_cast<void*>(addr), hugesize, MADV_HUGEPAGE);
+    memset(reinterpret_cast<void*>(addr), 1, hugesize);
+
+    ProcMemInfo proc_mem(getpid());
+    const std::vector<Vma>& maps = proc_mem.Maps();
+    ASSERT_FALSE(maps.empty());
+    const Vma* test_vma = nullptr;
+    for (const Vma& vma : maps) {
+        if (vma.start == addr) {
+            test_vma = &vma;
+            break;
+        }
+    }
+    ASSERT_TRUE(test_vma != nullptr) << "Cannot find test map.";
+
+    uint64_t hugesize_kb = hugesize / 1024;
+    EXPECT_EQ(hugesize_kb, test_vma->usage.vss);
+    EXPECT_EQ(hugesize_kb, test_vma->usage.rss);
+    EXPECT_EQ(hugesize_kb, test_vma->usage.uss);
+    EXPECT_EQ(hugesize_kb, test_vma->usage.pss);
+    EXPECT_EQ(hugesize_kb, test_vma->usage.private_dirty + test_vma->usage.private_clean);
+    EXPECT_TRUE(test_vma->usage.thp == 0 || test_vma->usage.thp == hugesize_kb)
+            << "thp " << test_vma->usage.thp;
+
+    ASSERT_EQ(0, munmap(reinterpret_cast<void*>(addr), hugesize));
+}
+
+TEST(PageAcct, ClassifyPageMap) {
+    // A mix of absent, present and swapped out entries, with whole words of absent entries
+    // and a tail that doesn't fill a word.
+    static constexpr size_t kNumEntries = 64 * 3 + 5;
+    static constexpr uint64_t kPresent = 1ULL << 63;
+    static constexpr uint64_t kSwapped = 1ULL << 62;
+    std::vector<uint64_t> entries(kNumEntries);
+    for (size_t i = 0; i < kNumEntries; i++) {
+        if (i >= 64 && i < 128) continue;
+        if (i % 3 == 0) {
+            entries[i] = kPresent | (i * 7);
+        } else if (i % 5 == 0) {
+            entries[i] = kSwapped | (i << 5);
+        }
+    }
+
+    std::vector<uint64_t> present_mask((kNumEntries + 63) / 64);
+    std::vector<uint64_t> swapped_mask(present_mask.size());
+    std::vector<uint64_t> pfns(kNumEntries);
+    size_t nr_present, nr_swapped;
+    ASSERT_TRUE(ClassifyPageMap(entries, present_mask, swapped_mask, pfns, &nr_present,
+                                &nr_swapped));
+    EXPECT_EQ(0, present_mask[1]);
+    EXPECT_EQ(0, swapped_mask[1]);
+
+    size_t expected_present = 0;
+    size_t expected_swapped = 0;
+    for (size_t i = 0; i < kNumEntries; i++) {
+        bool present = page_present(entries[i]);
+        bool swapped = page_swapped(entries[i]);
+        EXPECT_EQ(present, !!(present_mask[i / 64] & (1ULL << (i % 64)))) << "Entry " << i;
+        EXPECT_EQ(swapped, !!(swapped_mask[i / 64] & (1ULL << (i % 64)))) << "Entry " << i;
+        if (present) {
+            ASSERT_LT(expected_present, nr_present);
+            EXPECT_EQ(page_pfn(entries[i]), pfns[expected_present++]) << "Entry " << i;
+        }
+        expected_swapped += swapped;
+    }
+    EXPECT_EQ(expected_present, nr_present);
+    EXPECT_EQ(expected_swapped, nr_swapped);
+
+    // The outputs must have room for the whole chunk.
+    pfns.resize(kNumEntries - 1);
+    EXPECT_FALSE(ClassifyPageMap(entries, present_mask, swapped_mask, pfns, &nr_present,
+                                 &nr_swapped));
+}
+
+TEST(PageAcct, BatchLookupsMatchSingleLookups) {
+    static constexpr size_t kNumPages = 64;
+    size_t pagesize = getpagesize();
+    void* ptr = mmap(nullptr, pagesize * kNumPages, PROT_READ | PROT_WRITE,
+                     MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE, -1, 0);
+    ASSERT_NE(MAP_FAILED, ptr);
+    uintptr_t addr = reinterpret_cast<uintptr_t>(ptr);
+
+    Vma vma(addr, addr + kNumPages * pagesize, 0, PROT_READ | PROT_WRITE, "", 0, false);
+    ProcMemInfo proc_mem(getpid());
+    std::vector<uint64_t> pagemap;
+    ASSERT_TRUE(proc_mem.PageMap(vma, &pagemap));
+
+    std::vector<uint64_t> pfns;
+    for (uint64_t page_info : pagemap) {
+        if (android::meminfo::page_present(page_info)) {
+            pfns.emplace_back(android::meminfo::page_pfn(page_info));
+        }
+    }
+    ASSERT_FALSE(pfns.empty());
+
+    PageAcct& pinfo = PageAcct::Instance();
+    std::vector<uint64_t> flags(pfns.size());
+    std::vector<uint64_t> counts(pfns.size());
+    ASSERT_TRUE(pinfo.PageFlagsBatch(pfns, flags));
+    ASSERT_TRUE(pinfo.PageMapCountBatch(pfns, counts));
+    for (size_t i = 0; i < pfns.size(); i++) {
+        uint64_t page_flags;
+        uint64_t page_count;
+        ASSERT_TRUE(pinfo.PageFlags(pfns[i], &page_flags));
+        ASSERT_TRUE(pinfo.PageMapCount(pfns[i], &page_count));
+        EXPECT_EQ(page_flags & (1 << KPF_ANON), flags[i] & (1 << KPF_ANON));
+        EXPECT_EQ(page_count, counts[i]);
+    }
+
+    // Lookups in any order and with repeated page frames must resolve to the same values.
+    std::vector<uint64_t> shuffled(pfns.rbegin(), pfns.rend());
+    shuffled.insert(shuffled.end(), pfns.begin(), pfns.end());
+    std::vector<uint64_t> shuffled_counts(shuffled.size());
+    ASSERT_TRUE(pinfo.PageMapCountBatch(shuffled, shuffled_counts));
+    for (size_t i = 0; i < pfns.size(); i++) {
+        EXPECT_EQ(counts[i], shuffled_counts[pfns.size() - 1 - i]);
+        EXPECT_EQ(counts[i], shuffled_counts[pfns.size() + i]);
+    }
+
+    // Mismatched spans must be rejected.
+    counts.pop_back();
+    EXPECT_FALSE(pinfo.PageMapCountBatch(pfns, counts));
+
+    ASSERT_EQ(0, munmap(ptr, pagesize * kNumPages));
+}
+
+TEST(PageAcct, BatchedPageIdle) {
+    if (!PageAcct::KernelHasPageIdle()) {
+        GTEST_SKIP() << "Idle page tracking is not supported by the kernel";
+    }
+
+    static constexpr size_t kNumPages = 64;
+    size_t pagesize = getpagesize();
+    void* ptr = mmap(nullptr, pagesize * kNumPages, PROT_READ | PROT_WRITE,
+                     MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE, -1, 0);
+    ASSERT_NE(MAP_FAILED, ptr);
+    uintptr_t addr = reinterpret_cast<uintptr_t>(ptr);
+
+    Vma vma(addr, addr + kNumPages * pagesize, 0, PROT_READ | PROT_WRITE, "", 0, false);
+    ProcMemInfo proc_mem(getpid());
+    std::vector<uint64_t> pagemap;
+    ASSERT_TRUE(proc_mem.PageMap(vma, &pagemap));
+    std::vector<uint64_t> pfns;
+    for (uint64_t page_info : pagemap) {
+        ASSERT_TRUE(android::meminfo::page_present(page_info));
+        pfns.emplace_back(android::meminfo::page_pfn(page_info));
+    }
+
+    // Every marked page is idle until it is accessed again.
+    PageAcct& pinfo = PageAcct::Instance();
+    std::vector<uint8_t> idle(kNumPages);
+    ASSERT_TRUE(pinfo.MarkPagesIdle(pfns));
+    ASSERT_TRUE(pinfo.GetPagesIdle(pfns, idle));
+    for (size_t i = 0; i < kNumPages; i++) {
+        EXPECT_TRUE(idle[i]) << "Page " << i << " is not idle";
+    }
+
+    volatile uint8_t* data = reinterpret_cast<volatile uint8_t*>(addr);
+    for (size_t i = 0; i < kNumPages; i += 2) {
+        data[i * pagesize] = 1;
+    }
+    ASSERT_TRUE(pinfo.GetPagesIdle(pfns, idle));
+    for (size_t i = 0; i < kNumPages; i += 2) {
+        EXPECT_FALSE(idle[i]) << "Page " << i << " is idle after being accessed";
+    }
+
+    ASSERT_EQ(0, munmap(ptr, pagesize * kNumPages));
+}
+
+TEST(WorkingSetTracker, CollectRequiresArm) {
+    WorkingSetTracker tracker(getpid());
+    std::vector<Vma> wss;
+    EXPECT_FALSE(tracker.Collect(&wss));
+    EXPECT_TRUE(wss.empty());
+}
+
+TEST(WorkingSetTracker, AccessedPagesAreInWorkingSet) {
+    if (!PageAcct::KernelHasPageIdle()) {
+        GTEST_SKIP() << "Idle page tracking is not supported by the kernel";
+    }
+
+    static constexpr size_t kNumPages = 64;
+    size_t pagesize = getpagesize();
+    void* ptr = mmap(nullptr, pagesize * kNumPages, PROT_READ | PROT_WRITE,
+                     MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE, -1, 0);
+    ASSERT_NE(MAP_FAILED, ptr);
+    uintptr_t addr = reinterpret_cast<uintptr_t>(ptr);
+
+    WorkingSetTracker tracker(getpid());
+    for (int cycle = 0; cycle < 2; cycle++) {
+        ASSERT_TRUE(tracker.Arm());
+        volatile uint8_t* data = reinterpret_cast<volatile uint8_t*>(addr);
+        for (size_t i = 0; i < kNumPages; i += 2) {
+            data[i * pagesize] = 1;
+        }
+        std::vector<Vma> wss;
+        ASSERT_TRUE(tracker.Collect(&wss));
+
+        auto vma = std::find_if(wss.begin(), wss.end(), [addr](const Vma& v) {
+            return v.start <= addr && addr < v.end;
+        });
+        ASSERT_NE(wss.end(), vma);
+        EXPECT_GE(vma->usage.rss, kNumPages / 2 * pagesize / 1024);
+        EXPECT_EQ(vma->usage.vss, vma->usage.rss);
+    }
+
+    ASSERT_EQ(0, munmap(ptr, pagesize * kNumPages));
+}
+
+TEST(WorkingSetTracker, PagesFaultedInBetweenCyclesAreTracked) {
+    if (!PageAcct::KernelHasPageIdle()) {
+        GTEST_SKIP() << "Idle page tracking is not supported by the kernel";
+    }
+
+    static constexpr size_t kNumPages = 64;
+    size_t pagesize = getpagesize();
+    void* ptr = mmap(nullptr, pagesize * kNumPages, PROT_READ | PROT_WRITE,
+                     MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    ASSERT_NE(MAP_FAILED, ptr);
+    uintptr_t addr = reinterpret_cast<uintptr_t>(ptr);
+    volatile uint8_t* data = reinterpret_cast<volatile uint8_t*>(addr);
+    auto find_vma = [addr](const std::vector<Vma>& wss) {
+        return std::find_if(wss.begin(), wss.end(), [addr](const Vma& v) {
+            return v.start <= addr && addr < v.end;
+        });
+    };
+
+    // None of the pages are present yet, so the first cycle records no page frames for them.
+    WorkingSetTracker tracker(getpid());
+    std::vector<Vma> wss;
+    ASSERT_TRUE(tracker.Arm());
+    ASSERT_TRUE(tracker.Collect(&wss));
+    auto vma = find_vma(wss);
+    ASSERT_NE(wss.end(), vma);
+    EXPECT_EQ(vma->usage.rss, 0);
+
+    // Fault the pages in between cycles, without changing the vma. The next cycle must pick
+    // them up and see them accessed.
+    for (size_t i = 0; i < kNumPages; i++) {
+        data[i * pagesize] = 1;
+    }
+    ASSERT_TRUE(tracker.Arm());
+    for (size_t i = 0; i < kNumPages; i++) {
+        data[i * pagesize] = 2;
+    }
+    ASSERT_TRUE(tracker.Collect(&wss));
+    vma = find_vma(wss);
+    ASSERT_NE(wss.end(), vma);
+    EXPECT_GE(vma->usage.rss, kNumPages * pagesize / 1024);
+
+    ASSERT_EQ(0, munmap(ptr, pagesize * kNumPages));
+}
+
+TEST(PageAcct, ScanCacheMatchesKernel) {
+    ProcMemInfo proc_mem(getpid());
+    const std::vector<Vma>& maps = proc_mem.MapsWithoutUsageStats();
+    ASSERT_FALSE(maps.empty());
+
+    std::vector<uint64_t> pfns;
+    std::vector<uint64_t> pagemap;
+    for (const Vma& vma : maps) {
+        if (!proc_mem.PageMap(vma, &pagemap)) continue;
+        for (uint64_t page_info : pagemap) {
+            if (android::meminfo::page_present(page_info)) {
+                pfns.emplace_back(android::meminfo::page_pfn(page_info));
+            }
+        }
+    }
+    ASSERT_FALSE(pfns.empty());
+
+    PageAcct& pinfo = PageAcct::Instance();
+    std::vector<uint64_t> counts(pfns.size());
+    ASSERT_TRUE(pinfo.PageMapCountBatch(pfns, counts));
+
+    pinfo.BeginScan();
+    // The first lookup fills the cache and the second one is served from it.
+    for (int i = 0; i < 2; i++) {
+        std::vector<uint64_t> scan_counts(pfns.size());
+        ASSERT_TRUE(pinfo.PageMapCountBatch(pfns, scan_counts));
+        for (size_t j = 0; j < pfns.size(); j++) {
+            uint64_t page_count;
+            ASSERT_TRUE(pinfo.PageMapCount(pfns[j], &page_count));
+            EXPECT_EQ(scan_counts[j], page_count);
+        }
+    }
+    pinfo.EndScan();
+}
+
 TEST(ProcMemInfo, WssEmpty) {
     // If we created the object for getting usage,
     // the working set must be empty
@@ -232,12 +754,94 @@ TEST(ProcMemInfo, WssEmpty) {
     EXPECT_EQ(wss.swap, 0);
 }
 
+TEST(MemUsage, Arithmetic) {
+    static constexpr uint64_t MemUsage::*kCounters[] = {
+            &MemUsage::vss,           &MemUsage::rss,
+            &MemUsage::pss,           &MemUsage::uss,
+            &MemUsage::swap,          &MemUsage::swap_pss,
+            &MemUsage::private_clean, &MemUsage::private_dirty,
+            &MemUsage::shared_clean,  &MemUsage::shared_dirty,
+            &MemUsage::anon_huge_pages, &MemUsage::shmem_pmd_mapped,
+            &MemUsage::file_pmd_mapped, &MemUsage::shared_hugetlb,
+            &MemUsage::private_hugetlb, &MemUsage::locked,
+            &MemUsage::thp,
+    };
+    static_assert(std::size(kCounters) == MemUsage::kNumCounters);
+
+    // Give every counter a different value, so a counter that is left out shows.
+    MemUsage a;
+    MemUsage b;
+    for (size_t i = 0; i < MemUsage::kNumCounters; i++) {
+        a.*kCounters[i] = 100 + i;
+        b.*kCounters[i] = i % 2 ? 10 * i : 1000;
+    }
+
+    MemUsage sum = a;
+    sum += b;
+    MemUsage diff = sum;
+    diff -= b;
+    MemUsage saturated = a;
+    saturated.SaturatingSub(b);
+    MemUsage scaled = a;
+    scaled *= 1024;
+    for (size_t i = 0; i < MemUsage::kNumCounters; i++) {
+        uint64_t a_val = a.*kCounters[i];
+        uint64_t b_val = b.*kCounters[i];
+        EXPECT_EQ(a_val + b_val, sum.*kCounters[i]) << "Counter " << i;
+        EXPECT_EQ(a_val, diff.*kCounters[i]) << "Counter " << i;
+        EXPECT_EQ(a_val > b_val ? a_val - b_val : 0, saturated.*kCounters[i]) << "Counter " << i;
+        EXPECT_EQ(a_val * 1024, scaled.*kCounters[i]) << "Counter " << i;
+    }
+
+    sum.clear();
+    for (size_t i = 0; i < MemUsage::kNumCounters; i++) {
+        EXPECT_EQ(0, sum.*kCounters[i]) << "Counter " << i;
+    }
+}
+
 TEST(ProcMemInfo, SwapOffsetsEmpty) {
     // If we created the object for getting working set,
     // the swap offsets must be empty
     ProcMemInfo proc_mem(pid, true);
     const std::vector<uint64_t>& swap_offsets = proc_mem.SwapOffsets();
     EXPECT_EQ(swap_offsets.size(), 0);
+    EXPECT_TRUE(proc_mem.SwapSlots().empty());
+}
+
+TEST(SwapSlotList, PacksSlotsByType) {
+    // Slots of several swap types, out of order, with duplicates and offsets far apart.
+    std::vector<std::pair<uint32_t, uint64_t>> expected = {
+            {0, 0}, {0, 1}, {0, 1}, {0, 200}, {0, 1ULL << 40}, {1, 5}, {1, 6}, {3, 123456789},
+    };
+    std::vector<uint64_t> slots;
+    for (auto it = expected.rbegin(); it != expected.rend(); it++) {
+        slots.emplace_back(SwapSlotList::Slot(it->first, it->second));
+    }
+
+    SwapSlotList list;
+    list.Assign(&slots);
+    ASSERT_EQ(expected.size(), list.size());
+    EXPECT_EQ(3, list.MaxType());
+    EXPECT_EQ(1ULL << 40, list.MaxOffset(0));
+    EXPECT_EQ(6, list.MaxOffset(1));
+    EXPECT_EQ(-1, list.MaxOffset(2));
+
+    std::vector<std::pair<uint32_t, uint64_t>> found;
+    list.ForEach([&](uint32_t type, uint64_t offset) { found.emplace_back(type, offset); });
+    EXPECT_EQ(expected, found);
+
+    // Appended slots are merged in order.
+    slots = {SwapSlotList::Slot(2, 7), SwapSlotList::Slot(0, 100)};
+    list.Append(&slots);
+    expected.insert(expected.begin() + 3, {0, 100});
+    expected.insert(expected.begin() + 8, {2, 7});
+    found.clear();
+    list.ForEach([&](uint32_t type, uint64_t offset) { found.emplace_back(type, offset); });
+    EXPECT_EQ(expected, found);
+
+    list.clear();
+    EXPECT_TRUE(list.empty());
+    EXPECT_EQ(-1, list.MaxType());
 }
 
 TEST(ProcMemInfo, IsSmapsSupportedTest) {
@@ -317,6 +921,11 @@ VmFlags: rd wr mr mw me ac
     EXPECT_EQ(stats.private_clean, 84);
     EXPECT_EQ(stats.private_dirty, 2652);
     EXPECT_EQ(stats.swap_pss, 70);
+    // Only the fields above are parsed.
+    EXPECT_EQ(stats.vss, 0);
+    EXPECT_EQ(stats.shared_clean, 0);
+    EXPECT_EQ(stats.swap, 0);
+    EXPECT_EQ(stats.locked, 0);
 }
 
 TEST(ProcMemInfo, SmapsOrRollupPssRollupTest) {
@@ -365,6 +974,174 @@ TEST(ProcMemInfo, SmapsOrRollupPssSmapsTest) {
     EXPECT_EQ(pss, 19119);
 }
 
+TEST(ProcMemInfo, ParseContextTest) {
+    // Readers sharing one ParseContext must get the same results as with their own buffers.
+    std::string exec_dir = ::android::base::GetExecutableDirectory();
+    std::string smaps = ::android::base::StringPrintf("%s/testdata1/smaps", exec_dir.c_str());
+    std::string status = ::android::base::StringPrintf("%s/testdata1/status", exec_dir.c_str());
+    ParseContext ctx;
+
+    for (int i = 0; i < 2; i++) {
+        MemUsage expected, stats;
+        ASSERT_TRUE(SmapsOrRollupFromFile(smaps, &expected));
+        ASSERT_TRUE(SmapsOrRollupFromFile(smaps, &stats, ctx));
+        EXPECT_EQ(memcmp(&stats, &expected, sizeof(MemUsage)), 0);
+
+        uint64_t pss;
+        ASSERT_TRUE(SmapsOrRollupPssFromFile(smaps, &pss, ctx));
+        EXPECT_EQ(pss, 108384);
+
+        uint64_t rss;
+        ASSERT_TRUE(StatusVmRSSFromFile(status, &rss));
+        EXPECT_EQ(rss, 730764);
+
+        size_t nr_vmas = 0;
+        uint64_t vma_pss = 0;
+        VmaCallback count_vmas = [&](Vma& vma) {
+            nr_vmas++;
+            vma_pss += vma.usage.pss;
+            return true;
+        };
+        ASSERT_TRUE(ForEachVmaFromFile(smaps, count_vmas, true, ctx));
+        EXPECT_GT(nr_vmas, 0);
+        EXPECT_EQ(vma_pss, 108384);
+    }
+
+    ProcMemInfo proc_mem(pid);
+    uint64_t pss;
+    EXPECT_TRUE(proc_mem.SmapsOrRollupPss(&pss, ctx));
+    uint64_t rss;
+    EXPECT_TRUE(proc_mem.StatusVmRSS(&rss, ctx));
+}
+
+TEST(RollupReader, RereadsUntilExit) {
+    pid_t child = fork();
+    ASSERT_NE(child, -1);
+    if (child == 0) {
+        pause();
+        _exit(0);
+    }
+
+    RollupReader reader;
+    for (int i = 0; i < 3; i++) {
+        MemUsage stats;
+        ASSERT_TRUE(reader.SmapsOrRollup(child, &stats));
+        EXPECT_GT(stats.pss, 0);
+        EXPECT_EQ(stats.vss, 0);
+
+        // The child isn't running, its rss can't change.
+        MemUsage expected;
+        ASSERT_TRUE(ProcMemInfo(child).SmapsOrRollup(&expected));
+        EXPECT_EQ(stats.rss, expected.rss);
+
+        uint64_t pss;
+        ASSERT_TRUE(reader.SmapsOrRollupPss(child, &pss));
+        EXPECT_GT(pss, 0);
+    }
+    EXPECT_EQ(reader.size(), 1);
+
+    ASSERT_EQ(kill(child, SIGKILL), 0);
+    ASSERT_EQ(waitpid(child, nullptr, 0), child);
+    MemUsage stats;
+    errno = 0;
+    EXPECT_FALSE(reader.SmapsOrRollup(child, &stats));
+    EXPECT_EQ(errno, ESRCH);
+    EXPECT_EQ(reader.size(), 0);
+}
+
+TEST(RollupReader, RereadsAfterExec) {
+    // 'go' tells the child to exec, 'done' is closed by the exec.
+    int go[2], done[2];
+    ASSERT_EQ(pipe2(go, O_CLOEXEC), 0);
+    ASSERT_EQ(pipe2(done, O_CLOEXEC), 0);
+    pid_t child = fork();
+    ASSERT_NE(child, -1);
+    if (child == 0) {
+        char c;
+        close(done[0]);
+        if (read(go[0], &c, 1) != 1) _exit(1);
+        execl("/system/bin/sleep", "sleep", "100", nullptr);
+        execl("/bin/sleep", "sleep", "100", nullptr);
+        _exit(1);
+    }
+    close(go[0]);
+    close(done[1]);
+
+    RollupReader reader;
+    MemUsage stats;
+    ASSERT_TRUE(reader.SmapsOrRollup(child, &stats));
+
+    ASSERT_EQ(write(go[1], "x", 1), 1);
+    char c;
+    ASSERT_EQ(read(done[0], &c, 1), 0);
+    close(go[1]);
+    close(done[0]);
+
+    // The process is still running, only its address space was replaced.
+    EXPECT_TRUE(reader.SmapsOrRollup(child, &stats));
+    EXPECT_GT(stats.pss, 0);
+    EXPECT_EQ(reader.size(), 1);
+
+    ASSERT_EQ(kill(child, SIGKILL), 0);
+    ASSERT_EQ(waitpid(child, nullptr, 0), child);
+    errno = 0;
+    EXPECT_FALSE(reader.SmapsOrRollup(child, &stats));
+    EXPECT_EQ(errno, ESRCH);
+    EXPECT_EQ(reader.size(), 0);
+}
+
+TEST(ProcMemInfo, SmapsOrRollupBatch) {
+    pid_t live = fork();
+    ASSERT_NE(live, -1);
+    if (live == 0) {
+        pause();
+        _exit(0);
+    }
+    pid_t gone = fork();
+    ASSERT_NE(gone, -1);
+    if (gone == 0) {
+        _exit(0);
+    }
+    ASSERT_EQ(waitpid(gone, nullptr, 0), gone);
+
+    MemUsage expected;
+    ASSERT_TRUE(ProcMemInfo(live).SmapsOrRollup(&expected));
+
+    std::vector<pid_t> pids(16, live);
+    pids[5] = gone;
+    std::vector<MemUsage> stats(pids.size());
+    std::vector<SmapsReadStatus> status(pids.size());
+    EXPECT_FALSE(ProcMemInfo::SmapsOrRollupBatch(pids, stats, status, {.num_threads = 4}));
+    for (size_t i = 0; i < pids.size(); i++) {
+        if (pids[i] == gone) {
+            EXPECT_EQ(status[i], SmapsReadStatus::kGone);
+            EXPECT_EQ(stats[i].rss, 0);
+            continue;
+        }
+        // The child isn't running, its rss can't change.
+        EXPECT_EQ(status[i], SmapsReadStatus::kOk);
+        EXPECT_EQ(stats[i].rss, expected.rss);
+        EXPECT_GT(stats[i].pss, 0);
+    }
+
+    pids[5] = live;
+    EXPECT_TRUE(ProcMemInfo::SmapsOrRollupBatch(pids, stats));
+
+    // A deadline that passed already leaves all processes unread.
+    SmapsOrRollupBatchOptions options = {.deadline = std::chrono::steady_clock::now()};
+    EXPECT_FALSE(ProcMemInfo::SmapsOrRollupBatch(pids, stats, status, options));
+    for (size_t i = 0; i < pids.size(); i++) {
+        EXPECT_EQ(status[i], SmapsReadStatus::kDeadlineExceeded);
+        EXPECT_EQ(stats[i].pss, 0);
+    }
+
+    // Mismatched sizes are rejected.
+    EXPECT_FALSE(ProcMemInfo::SmapsOrRollupBatch(pids, std::span(stats).first(1)));
+
+    ASSERT_EQ(kill(live, SIGKILL), 0);
+    ASSERT_EQ(waitpid(live, nullptr, 0), live);
+}
+
 TEST(ProcMemInfo, StatusVmRSSTest) {
     std::string exec_dir = ::android::base::GetExecutableDirectory();
     std::string path = ::android::base::StringPrintf("%s/testdata1/status", exec_dir.c_str());
@@ -374,6 +1151,178 @@ TEST(ProcMemInfo, StatusVmRSSTest) {
     EXPECT_EQ(rss, 730764);
 }
 
+TEST(ProcStatus, FromFile) {
+    std::string exec_dir = ::android::base::GetExecutableDirectory();
+    std::string path = ::android::base::StringPrintf("%s/testdata1/status", exec_dir.c_str());
+
+    ProcStatus status;
+    ASSERT_TRUE(ProcStatusFromFile(path, kStatusAllFields, &status));
+    EXPECT_EQ(status.fields, kStatusAllFields);
+    EXPECT_EQ(status.vm_peak, 21856404);
+    EXPECT_EQ(status.vm_size, 20011648);
+    EXPECT_EQ(status.vm_lck, 215908);
+    EXPECT_EQ(status.vm_hwm, 859192);
+    EXPECT_EQ(status.vm_rss, 730764);
+    EXPECT_EQ(status.rss_anon, 229584);
+    EXPECT_EQ(status.rss_file, 499856);
+    EXPECT_EQ(status.rss_shmem, 1324);
+    EXPECT_EQ(status.vm_swap, 0);
+    EXPECT_EQ(status.threads, 218);
+
+    // Only the requested fields are set.
+    ASSERT_TRUE(ProcStatusFromFile(path, kStatusVmHWM | kStatusThreads, &status));
+    EXPECT_EQ(status.fields, kStatusVmHWM | kStatusThreads);
+    EXPECT_EQ(status.vm_hwm, 859192);
+    EXPECT_EQ(status.threads, 218);
+    EXPECT_EQ(status.vm_rss, 0);
+}
+
+TEST(ProcStatus, LongLine) {
+    // A line longer than the read buffer is skipped without losing the fields after it.
+    TemporaryFile tf;
+    ASSERT_TRUE(tf.fd != -1);
+    std::string groups = "Groups:\t" + std::string(10000, '1') + "\n";
+    ASSERT_TRUE(::android::base::WriteStringToFd(
+            "Name:\tfoo\n" + groups + "VmRSS:\t  1234 kB\nVmSwap:\t    12 kB\n", tf.fd));
+
+    ProcStatus status;
+    ASSERT_TRUE(ProcStatusFromFile(tf.path, kStatusAllFields, &status));
+    EXPECT_EQ(status.fields, kStatusVmRSS | kStatusVmSwap);
+    EXPECT_EQ(status.vm_rss, 1234);
+    EXPECT_EQ(status.vm_swap, 12);
+}
+
+TEST(ProcStatus, ReusedFd) {
+    pid_t child = fork();
+    ASSERT_NE(child, -1);
+    if (child == 0) {
+        pause();
+        _exit(0);
+    }
+
+    std::string path = ::android::base::StringPrintf("/proc/%d/status", child);
+    ::android::base::unique_fd fd(TEMP_FAILURE_RETRY(open(path.c_str(), O_RDONLY | O_CLOEXEC)));
+    ASSERT_NE(fd, -1);
+    for (int i = 0; i < 3; i++) {
+        ProcStatus status;
+        ASSERT_TRUE(ReadProcStatus(fd, kStatusVmRSS | kStatusThreads, &status));
+        EXPECT_EQ(status.fields, kStatusVmRSS | kStatusThreads);
+        EXPECT_GT(status.vm_rss, 0);
+        EXPECT_EQ(status.threads, 1);
+    }
+
+    ASSERT_EQ(kill(child, SIGKILL), 0);
+    ASSERT_EQ(waitpid(child, nullptr, 0), child);
+    ProcStatus status;
+    EXPECT_FALSE(ReadProcStatus(fd, kStatusVmRSS, &status));
+}
+
+TEST(SmapsSnapshot, DiffVmas) {
+    auto make_vma = [](uint64_t start, uint64_t end, const std::string& name, uint64_t rss) {
+        Vma vma(start, end, 0, PROT_READ, name, 0, false);
+        vma.usage.rss = rss;
+        return vma;
+    };
+    std::vector<Vma> old = {
+            make_vma(0x1000, 0x2000, "unchanged", 4),
+            make_vma(0x2000, 0x3000, "removed", 4),
+            make_vma(0x4000, 0x6000, "grown", 4),
+            make_vma(0x6000, 0x7000, "remapped", 4),
+            make_vma(0x8000, 0x9000, "shrunk", 4),
+    };
+    std::vector<Vma> cur = {
+            make_vma(0x1000, 0x2000, "unchanged", 4),
+            make_vma(0x3000, 0x4000, "added", 4),
+            make_vma(0x4000, 0x6000, "grown", 8),
+            make_vma(0x6000, 0x8000, "remapped", 8),
+            make_vma(0x8000, 0x9000, "shrunk", 0),
+    };
+
+    VmaDelta delta;
+    DiffVmas(old, cur, &delta);
+    ASSERT_EQ(delta.added.size(), 2);
+    EXPECT_EQ(delta.added[0].name, "added");
+    EXPECT_EQ(delta.added[1].name, "remapped");
+    EXPECT_EQ(delta.added[1].end, 0x8000);
+    ASSERT_EQ(delta.removed.size(), 2);
+    EXPECT_EQ(delta.removed[0].name, "removed");
+    EXPECT_EQ(delta.removed[1].name, "remapped");
+    EXPECT_EQ(delta.removed[1].end, 0x7000);
+    ASSERT_EQ(delta.changed.size(), 2);
+    EXPECT_EQ(delta.changed[0].vma.name, "grown");
+    EXPECT_EQ(delta.changed[0].vma.usage.rss, 8);
+    EXPECT_EQ(delta.changed[0].grown.rss, 4);
+    EXPECT_EQ(delta.changed[0].shrunk.rss, 0);
+    EXPECT_EQ(delta.changed[1].vma.name, "shrunk");
+    EXPECT_EQ(delta.changed[1].grown.rss, 0);
+    EXPECT_EQ(delta.changed[1].shrunk.rss, 4);
+
+    // Everything is added when there is nothing to compare with.
+    DiffVmas({}, cur, &delta);
+    EXPECT_EQ(delta.added.size(), cur.size());
+    EXPECT_TRUE(delta.removed.empty());
+    EXPECT_TRUE(delta.changed.empty());
+}
+
+TEST(SmapsSnapshot, UpdateFromFile) {
+    std::string exec_dir = ::android::base::GetExecutableDirectory();
+    std::string path = ::android::base::StringPrintf("%s/testdata1/smaps", exec_dir.c_str());
+
+    SmapsSnapshot snapshot(pid);
+    VmaDelta delta;
+    ASSERT_TRUE(snapshot.UpdateFromFile(path, &delta));
+    EXPECT_EQ(delta.added.size(), 2760);
+    EXPECT_TRUE(delta.removed.empty());
+    EXPECT_EQ(snapshot.vmas().size(), 2760);
+
+    // Nothing changed.
+    ASSERT_TRUE(snapshot.UpdateFromFile(path, &delta));
+    EXPECT_TRUE(delta.added.empty());
+    EXPECT_TRUE(delta.removed.empty());
+    EXPECT_TRUE(delta.changed.empty());
+
+    // Drop the first vma and change the Rss of the second one.
+    std::string smaps;
+    ASSERT_TRUE(::android::base::ReadFileToString(path, &smaps));
+    size_t second = smaps.find("\n13440000-");
+    ASSERT_NE(second, std::string::npos);
+    size_t rss = smaps.find("\nRss:", second);
+    ASSERT_NE(rss, std::string::npos);
+    smaps.replace(rss, smaps.find('\n', rss + 1) - rss, "\nRss:              100 kB");
+    smaps.erase(0, second + 1);
+    TemporaryFile tf;
+    ASSERT_TRUE(tf.fd != -1);
+    ASSERT_TRUE(::android::base::WriteStringToFd(smaps, tf.fd));
+
+    const Vma first = snapshot.vmas()[0];
+    const Vma before = snapshot.vmas()[1];
+    ASSERT_TRUE(snapshot.UpdateFromFile(tf.path, &delta));
+    EXPECT_TRUE(delta.added.empty());
+    ASSERT_EQ(delta.removed.size(), 1);
+    EXPECT_EQ(delta.removed[0].start, first.start);
+    ASSERT_EQ(delta.changed.size(), 1);
+    const VmaChange& change = delta.changed[0];
+    EXPECT_EQ(change.vma.start, before.start);
+    EXPECT_EQ(change.vma.name, before.name);
+    EXPECT_EQ(change.vma.usage.rss, 100);
+    if (before.usage.rss > 100) {
+        EXPECT_EQ(change.shrunk.rss, before.usage.rss - 100);
+    } else {
+        EXPECT_EQ(change.grown.rss, 100 - before.usage.rss);
+    }
+    EXPECT_EQ(snapshot.vmas().size(), 2759);
+}
+
+TEST(SmapsSnapshot, Update) {
+    SmapsSnapshot snapshot(pid);
+    VmaDelta delta;
+    ASSERT_TRUE(snapshot.Update(&delta));
+    EXPECT_FALSE(delta.added.empty());
+    EXPECT_EQ(delta.added.size(), snapshot.vmas().size());
+    ASSERT_TRUE(snapshot.Update(&delta));
+    EXPECT_FALSE(snapshot.vmas().empty());
+}
+
 TEST(ProcMemInfo, StatusVmRSSBogusFileTest) {
     std::string exec_dir = ::android::base::GetExecutableDirectory();
     std::string path = ::android::base::StringPrintf("%s/testdata1/smaps", exec_dir.c_str());
@@ -533,6 +1482,51 @@ TEST(ProcMemInfo, ForEachExistingVmaTest) {
 #endif
 }
 
+TEST(ProcMemInfo, ForEachVmaCallbackOverloads) {
+    // Callables are called directly, std::functions through the exported overloads; both must
+    // see the same vmas, and stop when the callback returns false.
+    std::string exec_dir = ::android::base::GetExecutableDirectory();
+    std::string path = ::android::base::StringPrintf("%s/testdata1/smaps", exec_dir.c_str());
+
+    std::vector<Vma> expected;
+    VmaCallback collect_expected = [&](Vma& vma) {
+        expected.push_back(vma);
+        return true;
+    };
+    ASSERT_TRUE(ForEachVmaFromFile(path, collect_expected));
+    ASSERT_EQ(expected.size(), 2760);
+
+    size_t nr_vmas = 0;
+    uint64_t pss = 0;
+    auto check_vma = [&](Vma& vma) {
+        EXPECT_EQ(vma.start, expected[nr_vmas].start);
+        EXPECT_EQ(vma.name, expected[nr_vmas].name);
+        pss += vma.usage.pss;
+        return ++nr_vmas < 10;
+    };
+    EXPECT_FALSE(ForEachVmaFromFile(path, check_vma));
+    EXPECT_EQ(nr_vmas, 10);
+
+    ProcMemInfo proc_mem(pid);
+    proc_mem.Smaps(path);
+    nr_vmas = 0;
+    EXPECT_FALSE(proc_mem.ForEachExistingVma(check_vma));
+    EXPECT_EQ(nr_vmas, 10);
+
+    VmaCallback count_vmas = [&](Vma&) {
+        nr_vmas++;
+        return true;
+    };
+    nr_vmas = 0;
+    EXPECT_TRUE(proc_mem.ForEachVmaFromMaps(count_vmas));
+    size_t nr_maps = nr_vmas;
+    EXPECT_GT(nr_maps, 0);
+    nr_vmas = 0;
+    EXPECT_TRUE(proc_mem.ForEachVmaFromMaps([&](Vma&) { return ++nr_vmas > 0; }));
+    // Both read the maps of this process, which may gain a vma in between.
+    EXPECT_NEAR(nr_vmas, nr_maps, 2);
+}
+
 TEST(ProcMemInfo, ForEachVmaFromFile_SmapsTest) {
     // Parse smaps file correctly to make callbacks for each virtual memory area (vma)
     std::string exec_dir = ::android::base::GetExecutableDirectory();
@@ -756,6 +1750,59 @@ TEST(ProcMemInfo, ForEachVmaFromFile_MapsTest) {
     EXPECT_EQ(vmas[5].inode, 0);
 }
 
+TEST(ProcMemInfo, ForEachVmaViewFromFile_SmapsTest) {
+    // The in place parser must hand out the same vmas as ForEachVmaFromFile, also when its
+    // buffer is reused.
+    std::string exec_dir = ::android::base::GetExecutableDirectory();
+    std::string path = ::android::base::StringPrintf("%s/testdata1/smaps", exec_dir.c_str());
+
+    std::vector<Vma> vmas;
+    auto collect_vmas = [&](const Vma& v) {
+        vmas.push_back(v);
+        return true;
+    };
+    ASSERT_TRUE(ForEachVmaFromFile(path, collect_vmas));
+    ASSERT_FALSE(vmas.empty());
+
+    std::string buffer;
+    for (int pass = 0; pass < 2; pass++) {
+        size_t i = 0;
+        uint64_t pss = 0;
+        auto check_vma = [&](const VmaView& v) {
+            if (i >= vmas.size()) {
+                ADD_FAILURE() << "Too many vmas";
+                return false;
+            }
+            const Vma& expected = vmas[i++];
+            EXPECT_EQ(v.start, expected.start);
+            EXPECT_EQ(v.end, expected.end);
+            EXPECT_EQ(v.offset, expected.offset);
+            EXPECT_EQ(v.flags, expected.flags);
+            EXPECT_EQ(v.name, expected.name);
+            EXPECT_EQ(v.inode, expected.inode);
+            EXPECT_EQ(v.is_shared, expected.is_shared);
+            EXPECT_EQ(memcmp(&v.usage, &expected.usage, sizeof(MemUsage)), 0);
+            // A Vma made from the view owns a copy of its name.
+            Vma owned(v);
+            EXPECT_EQ(owned.start, expected.start);
+            EXPECT_EQ(owned.name, expected.name);
+            EXPECT_NE(owned.name.data(), v.name.data());
+            EXPECT_TRUE(owned.usage == expected.usage);
+            pss += v.usage.pss;
+            return true;
+        };
+        ASSERT_TRUE(ForEachVmaViewFromFile(path, check_vma, true, &buffer));
+        EXPECT_EQ(i, vmas.size());
+        EXPECT_EQ(pss, 108384);
+    }
+
+    // Stopping early is reported.
+    size_t calls = 0;
+    auto stop = [&](const VmaView&) { return ++calls < 3; };
+    EXPECT_FALSE(ForEachVmaViewFromFile(path, stop));
+    EXPECT_EQ(calls, 3);
+}
+
 TEST(ProcMemInfo, SmapsReturnTest) {
     // Make sure Smaps() is never empty for any process
     ProcMemInfo proc_mem(pid);
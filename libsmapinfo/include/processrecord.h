@@ -36,7 +36,9 @@ class ProcessRecord final {
                   bool get_cmdline, bool get_oomadj, std::ostream& err);
 
     bool valid() const;
-    void CalculateSwap(const std::vector<uint16_t>& swap_offset_array,
+    // 'swap_slot_counts[type][offset]' is the number of pages that use a swap slot. Slots
+    // without a count are skipped.
+    void CalculateSwap(const std::vector<std::vector<uint16_t>>& swap_slot_counts,
                        float zram_compression_ratio);
 
     // Getters
@@ -48,7 +50,7 @@ class ProcessRecord final {
     uint64_t zswap() const { return zswap_; }
 
     // Wrappers to ProcMemInfo
-    const std::vector<uint64_t>& SwapOffsets() const { return swap_offsets_; }
+    const ::android::meminfo::SwapSlotList& SwapSlots() const { return swap_slots_; }
     // show_wss may be used to return differentiated output in the future.
     const ::android::meminfo::MemUsage& Usage([[maybe_unused]] bool show_wss) const {
         return usage_or_wss_;
@@ -67,7 +69,7 @@ class ProcessRecord final {
     uint64_t unique_swap_;
     uint64_t zswap_;
     ::android::meminfo::MemUsage usage_or_wss_;
-    std::vector<uint64_t> swap_offsets_;
+    ::android::meminfo::SwapSlotList swap_slots_;
 };
 
 }  // namespace smapinfo
@@ -95,7 +95,7 @@ ProcessRecord::ProcessRecord(pid_t pid, bool get_wss, uint64_t pgflags, uint64_t
     // these will fall back on the slower ReadMaps().
     procmem_.Smaps("", true, true);
     usage_or_wss_ = get_wss ? procmem_.Wss() : procmem_.Usage();
-    swap_offsets_ = procmem_.SwapOffsets();
+    swap_slots_ = procmem_.SwapSlots();
     pid_ = pid;
 }
 
@@ -103,13 +103,17 @@ bool ProcessRecord::valid() const {
     return pid_ != -1;
 }
 
-void ProcessRecord::CalculateSwap(const std::vector<uint16_t>& swap_offset_array,
+void ProcessRecord::CalculateSwap(const std::vector<std::vector<uint16_t>>& swap_slot_counts,
                                   float zram_compression_ratio) {
-    for (auto& off : swap_offsets_) {
-        proportional_swap_ += getpagesize() / swap_offset_array[off];
-        unique_swap_ += swap_offset_array[off] == 1 ? getpagesize() : 0;
+    swap_slots_.ForEach([&](uint32_t type, uint64_t offset) {
+        // Only slots counted by procrank have a count.
+        if (type >= swap_slot_counts.size() || offset >= swap_slot_counts[type].size()) return;
+        uint16_t count = swap_slot_counts[type][offset];
+        if (count == 0) return;
+        proportional_swap_ += getpagesize() / count;
+        unique_swap_ += count == 1 ? getpagesize() : 0;
         zswap_ = proportional_swap_ * zram_compression_ratio;
-    }
+    });
     // This is divided by 1024 to convert to KB.
     proportional_swap_ /= 1024;
     unique_swap_ /= 1024;
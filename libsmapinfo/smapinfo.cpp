@@ -20,18 +20,21 @@
 #include <sys/mman.h>
 #include <unistd.h>
 
+#include <algorithm>
 #include <chrono>
 #include <functional>
 #include <iomanip>
 #include <iostream>
 #include <set>
 #include <string>
+#include <string_view>
 #include <vector>
 
 #include <android-base/file.h>
 #include <android-base/parseint.h>
 #include <android-base/stringprintf.h>
 #include <android-base/strings.h>
+#include <meminfo/pageacct.h>
 #include <meminfo/sysmeminfo.h>
 
 #include <processrecord.h>
@@ -45,7 +48,10 @@ using ::android::meminfo::EscapeCsvString;
 using ::android::meminfo::EscapeJsonString;
 using ::android::meminfo::Format;
 using ::android::meminfo::MemUsage;
+using ::android::meminfo::PageAcct;
+using ::android::meminfo::SwapSlotList;
 using ::android::meminfo::Vma;
+using ::android::meminfo::VmaView;
 
 bool get_all_pids(std::set<pid_t>* pids) {
     pids->clear();
@@ -63,22 +69,40 @@ bool get_all_pids(std::set<pid_t>* pids) {
 
 namespace procrank {
 
-static bool count_swap_offsets(const ProcessRecord& proc, std::vector<uint16_t>& swap_offset_array,
-                               std::ostream& err) {
-    const std::vector<uint64_t>& swp_offs = proc.SwapOffsets();
-    for (auto& off : swp_offs) {
-        if (off >= swap_offset_array.size()) {
+static bool count_swap_offsets(const ProcessRecord& proc,
+                               std::vector<std::vector<uint16_t>>& swap_slot_counts,
+                               uint64_t max_swap_offset, std::ostream& err) {
+    const SwapSlotList& swap_slots = proc.SwapSlots();
+    if (swap_slots.empty()) return true;
+
+    // Counters are only allocated up to the highest offset in use of each swap type.
+    size_t num_types = swap_slots.MaxType() + 1;
+    if (swap_slot_counts.size() < num_types) {
+        swap_slot_counts.resize(num_types);
+    }
+    bool ok = true;
+    swap_slots.ForEach([&](uint32_t type, uint64_t off) {
+        if (!ok) return;
+        if (off > max_swap_offset) {
             err << "swap offset " << off << " is out of bounds for process: " << proc.pid() << "\n";
-            return false;
+            ok = false;
+            return;
+        }
+        std::vector<uint16_t>& counts = swap_slot_counts[type];
+        if (off >= counts.size()) {
+            // A bad offset past the end of swap must not make the counters grow beyond it.
+            uint64_t max_offset = std::min<uint64_t>(swap_slots.MaxOffset(type), max_swap_offset);
+            counts.resize(max_offset + 1, 0);
         }
-        if (swap_offset_array[off] == USHRT_MAX) {
+        if (counts[off] == USHRT_MAX) {
             err << "swap offset " << off << " ref count overflow in process: " << proc.pid()
                 << "\n";
-            return false;
+            ok = false;
+            return;
         }
-        swap_offset_array[off]++;
-    }
-    return true;
+        counts[off]++;
+    });
+    return ok;
 }
 
 struct params {
@@ -139,7 +163,8 @@ static std::function<bool(ProcessRecord& a, ProcessRecord& b)> select_sort(struc
 }
 
 static bool populate_procs(struct params* params, uint64_t pgflags, uint64_t pgflags_mask,
-                           std::vector<uint16_t>& swap_offset_array, const std::set<pid_t>& pids,
+                           std::vector<std::vector<uint16_t>>& swap_slot_counts,
+                           uint64_t max_swap_offset, const std::set<pid_t>& pids,
                            std::vector<ProcessRecord>* procs,
                            std::map<pid_t, ProcessRecord>* processrecords_ptr, std::ostream& err) {
     // Fall back to using an empty map of ProcessRecords if nullptr was passed in.
@@ -180,7 +205,7 @@ static bool populate_procs(struct params* params, uint64_t pgflags, uint64_t pgf
 
         // Collect swap_offset counts from all processes in 1st pass.
         if (!params->show_wss && params->swap_enabled &&
-            !count_swap_offsets(proc, swap_offset_array, err)) {
+            !count_swap_offsets(proc, swap_slot_counts, max_swap_offset, err)) {
             err << "Failed to count swap offsets for process: " << pid << "\n";
             err << "Failed to read all pids from the system\n";
             return false;
@@ -300,11 +325,11 @@ static void print_sysmeminfo(struct params* params, const ::android::meminfo::Sy
 }
 
 static void add_to_totals(struct params* params, ProcessRecord& proc,
-                          const std::vector<uint16_t>& swap_offset_array) {
+                          const std::vector<std::vector<uint16_t>>& swap_slot_counts) {
     params->total_pss += proc.Usage(params->show_wss).pss;
     params->total_uss += proc.Usage(params->show_wss).uss;
     if (!params->show_wss && params->swap_enabled) {
-        proc.CalculateSwap(swap_offset_array, params->zram_compression_ratio);
+        proc.CalculateSwap(swap_slot_counts, params->zram_compression_ratio);
         params->total_swap += proc.Usage(params->show_wss).swap;
         params->total_pswap += proc.proportional_swap();
         params->total_uswap += proc.unique_swap();
@@ -343,8 +368,10 @@ bool run_procrank(uint64_t pgflags, uint64_t pgflags_mask, const std::set<pid_t>
     // Figure out swap and zram.
     uint64_t swap_total = smi.mem_swap_kb() * 1024;
     params.swap_enabled = swap_total > 0;
-    // Allocate the swap array.
-    std::vector<uint16_t> swap_offset_array(swap_total / getpagesize() + 1, 0);
+    // Use counts of each swap slot in use, by swap type and offset. No swap device is larger
+    // than all of swap.
+    std::vector<std::vector<uint16_t>> swap_slot_counts;
+    uint64_t max_swap_offset = swap_total / getpagesize();
     if (params.swap_enabled) {
         params.zram_enabled = smi.mem_zram_kb() > 0;
         if (params.zram_enabled) {
@@ -353,9 +380,16 @@ bool run_procrank(uint64_t pgflags, uint64_t pgflags_mask, const std::set<pid_t>
         }
     }
 
+    // Pages shared between processes only need to be looked up once while the records are
+    // being populated.
+    PageAcct& pinfo = PageAcct::Instance();
+    pinfo.BeginScan();
     std::vector<ProcessRecord> procs;
-    if (!procrank::populate_procs(&params, pgflags, pgflags_mask, swap_offset_array, pids, &procs,
-                                  processrecords_ptr, err)) {
+    bool populated =
+            procrank::populate_procs(&params, pgflags, pgflags_mask, swap_slot_counts,
+                                     max_swap_offset, pids, &procs, processrecords_ptr, err);
+    pinfo.EndScan();
+    if (!populated) {
         return false;
     }
 
@@ -384,7 +418,7 @@ bool run_procrank(uint64_t pgflags, uint64_t pgflags_mask, const std::set<pid_t>
     procrank::print_header(&params, out);
 
     for (auto& proc : procs) {
-        procrank::add_to_totals(&params, proc, swap_offset_array);
+        procrank::add_to_totals(&params, proc, swap_slot_counts);
         procrank::print_processrecord(&params, proc, out);
     }
 
@@ -397,20 +431,6 @@ bool run_procrank(uint64_t pgflags, uint64_t pgflags_mask, const std::set<pid_t>
 
 namespace librank {
 
-static void add_mem_usage(MemUsage* to, const MemUsage& from) {
-    to->vss += from.vss;
-    to->rss += from.rss;
-    to->pss += from.pss;
-    to->uss += from.uss;
-
-    to->swap += from.swap;
-
-    to->private_clean += from.private_clean;
-    to->private_dirty += from.private_dirty;
-    to->shared_clean += from.shared_clean;
-    to->shared_dirty += from.shared_dirty;
-}
-
 // Represents a specific process's usage of a library.
 struct LibProcRecord {
   public:
@@ -422,7 +442,7 @@ struct LibProcRecord {
     }
 
     bool valid() const { return pid_ != -1; }
-    void AddUsage(const MemUsage& mem_usage) { add_mem_usage(&usage_, mem_usage); }
+    void AddUsage(const MemUsage& mem_usage) { usage_ += mem_usage; }
 
     // Getters
     pid_t pid() const { return pid_; }
@@ -446,7 +466,7 @@ struct LibRecord {
         auto [it, inserted] = procs_.insert(std::pair<pid_t, LibProcRecord>(proc.pid(), proc));
         // Adds to proc's PID's contribution to usage of this lib, as well as total lib usage.
         it->second.AddUsage(mem_usage);
-        add_mem_usage(&usage_, mem_usage);
+        usage_ += mem_usage;
     }
     uint64_t pss() const { return usage_.pss; }
 
@@ -727,8 +747,12 @@ bool run_librank(uint64_t pgflags, uint64_t pgflags_mask, const std::set<pid_t>&
 
     // Fills in usage info for each LibRecord.
     std::map<std::string, librank::LibRecord> lib_name_map;
-    if (!librank::populate_libs(&params, pgflags, pgflags_mask, pids, lib_name_map,
-                                processrecords_ptr, err)) {
+    PageAcct& pinfo = PageAcct::Instance();
+    pinfo.BeginScan();
+    bool populated = librank::populate_libs(&params, pgflags, pgflags_mask, pids, lib_name_map,
+                                            processrecords_ptr, err);
+    pinfo.EndScan();
+    if (!populated) {
         return false;
     }
 
@@ -801,10 +825,12 @@ struct VmaInfo {
     uint32_t count;
 
     VmaInfo() : is_bss(false), count(0) {};
-    VmaInfo(const Vma& v) : vma(v), is_bss(false), count(1) {}
-    VmaInfo(const Vma& v, bool bss) : vma(v), is_bss(bss), count(1) {}
-    VmaInfo(const Vma& v, const std::string& name, bool bss) : vma(v), is_bss(bss), count(1) {
-        vma.name = name;
+    VmaInfo(const Vma& v, std::string_view name, bool bss) : vma(v), is_bss(bss), count(1) {
+        vma.name.assign(name);
+    }
+    VmaInfo(VmaView v, std::string_view name, bool bss) : is_bss(bss), count(1) {
+        v.name = name;
+        vma = v;
     }
 
     void to_raw(bool total, std::ostream& out) const;
@@ -924,90 +950,67 @@ void VmaInfo::to_json(bool total, std::ostream& out) const {
     out << ",\"object\":" << EscapeJsonString(get_vma_name(vma, total, is_bss)) << "}";
 }
 
-static bool is_library(const std::string& name) {
+static bool is_library(std::string_view name) {
     return (name.size() > 4) && (name[0] == '/') && ::android::base::EndsWith(name, ".so");
 }
 
-static void infer_vma_name(VmaInfo& current, const VmaInfo& recent) {
-    if (current.vma.name.empty()) {
-        if (recent.vma.end == current.vma.start && is_library(recent.vma.name)) {
-            current.vma.name = recent.vma.name;
-            current.is_bss = true;
-        } else {
-            current.vma.name = "[anon]";
-        }
-    }
-}
+// The name and end address of the previous vma, for infer_vma_name().
+static std::string recent_name;
+static uint64_t recent_end;
 
-static void add_mem_usage(MemUsage* to, const MemUsage& from) {
-    to->vss += from.vss;
-    to->rss += from.rss;
-    to->pss += from.pss;
-
-    to->swap += from.swap;
-    to->swap_pss += from.swap_pss;
-
-    to->private_clean += from.private_clean;
-    to->private_dirty += from.private_dirty;
-    to->shared_clean += from.shared_clean;
-    to->shared_dirty += from.shared_dirty;
-
-    to->anon_huge_pages += from.anon_huge_pages;
-    to->shmem_pmd_mapped += from.shmem_pmd_mapped;
-    to->file_pmd_mapped += from.file_pmd_mapped;
-    to->shared_hugetlb += from.shared_hugetlb;
-    to->private_hugetlb += from.private_hugetlb;
-    to->locked += from.locked;
+// Returns the name 'vma' is shown as, and sets 'is_bss' if it is the bss of the library before.
+template <typename VmaType>
+static std::string_view infer_vma_name(const VmaType& vma, bool* is_bss) {
+    *is_bss = false;
+    if (!vma.name.empty()) {
+        return vma.name;
+    }
+    if (recent_end == vma.start && is_library(recent_name)) {
+        *is_bss = true;
+        return recent_name;
+    }
+    return "[anon]";
 }
 
 // A multimap is used instead of a map to allow for duplicate keys in case verbose output is used.
-static std::multimap<std::string, VmaInfo> vmas;
-
-static bool collect_vma(const Vma& vma) {
-    static VmaInfo recent;
-    VmaInfo current(vma);
+// std::less<> lets it be searched by std::string_view.
+static std::multimap<std::string, VmaInfo, std::less<>> vmas;
+
+// Collects either a Vma or a VmaView. With a VmaView, no string is built for vmas that are
+// coalesced into one already collected.
+template <typename VmaType>
+static bool collect_vma(const VmaType& vma) {
+    bool first = vmas.empty();
+    bool is_bss = false;
+    // The first vma is kept as-is.
+    std::string_view name = first ? std::string_view(vma.name) : infer_vma_name(vma, &is_bss);
+    // 'name' may point into recent_name, which is only updated once it has been used.
+    auto update_recent = [&]() {
+        if (name.data() != recent_name.data()) {
+            recent_name.assign(name);
+        }
+        recent_end = vma.end;
+    };
 
-    std::string key;
     if (show_addr) {
         // vma.end is included in case vma.start is identical for two VMAs.
-        key = StringPrintf("%16" PRIx64 "%16" PRIx64, vma.start, vma.end);
-    } else {
-        key = vma.name;
-    }
-
-    if (vmas.empty()) {
-        vmas.emplace(key, current);
-        recent = current;
+        vmas.emplace(StringPrintf("%16" PRIx64 "%16" PRIx64, vma.start, vma.end),
+                     VmaInfo(vma, name, is_bss));
+        update_recent();
         return true;
     }
 
-    infer_vma_name(current, recent);
-    recent = current;
-
-    // If sorting by address, the VMA can be placed into the map as-is.
-    if (show_addr) {
-        vmas.emplace(key, current);
-        return true;
-    }
-
-    // infer_vma_name() may have changed current.vma.name, so this key needs to be set again before
-    // using it to sort by name. For verbose output, the VMA can immediately be placed into the map.
-    key = current.vma.name;
-    if (verbose) {
-        vmas.emplace(key, current);
-        return true;
-    }
-
-    // Coalesces VMAs' usage by name, if !show_addr && !verbose.
-    auto iter = vmas.find(key);
+    // For verbose output, or if sorting by address, the VMA can immediately be placed into the
+    // map. Otherwise VMAs' usage is coalesced by name.
+    auto iter = (first || verbose) ? vmas.end() : vmas.find(name);
     if (iter == vmas.end()) {
-        vmas.emplace(key, current);
-        return true;
+        vmas.emplace(std::string(name), VmaInfo(vma, name, is_bss));
+    } else {
+        VmaInfo& match = iter->second;
+        match.vma.usage += vma.usage;
+        match.is_bss &= is_bss;
     }
-
-    VmaInfo& match = iter->second;
-    add_mem_usage(&match.vma.usage, current.vma.usage);
-    match.is_bss &= current.is_bss;
+    update_recent();
     return true;
 }
 
@@ -1129,10 +1132,11 @@ bool run_showmap(pid_t pid, const std::string& filename, bool terse, bool verbos
 
     bool success;
     if (!filename.empty()) {
-        success = ::android::meminfo::ForEachVmaFromFile(filename, showmap::collect_vma);
+        success = ::android::meminfo::ForEachVmaViewFromFile(
+                filename, [](const VmaView& vma) { return showmap::collect_vma(vma); });
     } else if (!processrecords_ptr) {
         ProcessRecord proc(pid, false, 0, 0, false, false, err);
-        success = proc.ForEachExistingVma(showmap::collect_vma);
+        success = proc.ForEachExistingVma(showmap::collect_vma<Vma>);
     } else {
         // Check if a ProcessRecord already exists for this pid, create one if one does not exist.
         auto iter = processrecords_ptr->find(pid);
@@ -1142,7 +1146,7 @@ bool run_showmap(pid_t pid, const std::string& filename, bool terse, bool verbos
                         : processrecords_ptr
                                   ->emplace(pid, ProcessRecord(pid, false, 0, 0, false, false, err))
                                   .first->second;
-        success = proc.ForEachExistingVma(showmap::collect_vma);
+        success = proc.ForEachExistingVma(showmap::collect_vma<Vma>);
     }
 
     if (!success) {
@@ -1161,7 +1165,7 @@ bool run_showmap(pid_t pid, const std::string& filename, bool terse, bool verbos
     showmap::VmaInfo total_usage;
     for (const auto& entry : showmap::vmas) {
         const showmap::VmaInfo& v = entry.second;
-        showmap::add_mem_usage(&total_usage.vma.usage, v.vma.usage);
+        total_usage.vma.usage += v.vma.usage;
         total_usage.count += v.count;
         if (terse && !(v.vma.usage.private_dirty || v.vma.usage.private_clean)) {
             continue;
@@ -1251,7 +1255,10 @@ bool run_bugreport_procdump(std::ostream& out, std::ostream& err) {
     // procrank will only print already-collected information. This duration is captured by
     // dumpstate in the BUGREPORT PROCDUMP section.
     std::map<pid_t, ProcessRecord> processrecords;
+    PageAcct& pinfo = PageAcct::Instance();
+    pinfo.BeginScan();
     bugreport_procdump::create_processrecords(pids, processrecords, err);
+    pinfo.EndScan();
 
     // pids without associated ProcessRecords are removed so that librank/procrank do not fall back
     // to creating new ProcessRecords for them.
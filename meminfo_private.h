@@ -16,6 +16,8 @@
 
 #pragma once
 
+#include <linux/fs.h>
+#include <linux/types.h>
 #include <sys/types.h>
 #include <unistd.h>
 
@@ -23,7 +25,10 @@
 #include <meminfo/meminfo.h>
 #include <meminfo/pageacct.h>
 #include <meminfo/procmeminfo.h>
+#include <meminfo/rollupreader.h>
+#include <meminfo/swapslotlist.h>
 #include <meminfo/sysmeminfo.h>
+#include <meminfo/workingsettracker.h>
 
 #define _BITS(x, offset, bits) (((x) >> (offset)) & ((1LL << (bits)) - 1))
 
@@ -31,9 +36,47 @@
 #define PAGE_PRESENT(x) (_BITS(x, 63, 1))
 #define PAGE_SWAPPED(x) (_BITS(x, 62, 1))
 #define PAGE_SHIFT(x) (_BITS(x, 55, 6))
+#define PAGE_SOFT_DIRTY(x) (_BITS(x, 55, 1))
+#define PAGE_EXCLUSIVE(x) (_BITS(x, 56, 1))
 #define PAGE_PFN(x) (_BITS(x, 0, 55))
 #define PAGE_SWAP_OFFSET(x) (_BITS(x, 5, 50))
 #define PAGE_SWAP_TYPE(x) (_BITS(x, 0, 5))
 
 // Macros to do per-page kpageflags data manipulation
 #define KPAGEFLAG_THP(x) (_BITS(x, 22, 1))
+
+// PAGEMAP_SCAN ioctl on /proc/<pid>/pagemap (Linux 6.7+). These come from <linux/fs.h>, and
+// are only defined here when building against older kernel headers.
+#ifndef PAGEMAP_SCAN
+#define PAGE_IS_WPALLOWED (1 << 0)
+#define PAGE_IS_WRITTEN (1 << 1)
+#define PAGE_IS_FILE (1 << 2)
+#define PAGE_IS_PRESENT (1 << 3)
+#define PAGE_IS_SWAPPED (1 << 4)
+#define PAGE_IS_PFNZERO (1 << 5)
+#define PAGE_IS_HUGE (1 << 6)
+#define PAGE_IS_SOFT_DIRTY (1 << 7)
+
+struct page_region {
+    __u64 start;
+    __u64 end;
+    __u64 categories;
+};
+
+struct pm_scan_arg {
+    __u64 size;
+    __u64 flags;
+    __u64 start;
+    __u64 end;
+    __u64 walk_end;
+    __u64 vec;
+    __u64 vec_len;
+    __u64 max_pages;
+    __u64 category_inverted;
+    __u64 category_mask;
+    __u64 category_anyof_mask;
+    __u64 return_mask;
+};
+
+#define PAGEMAP_SCAN _IOWR('f', 16, struct pm_scan_arg)
+#endif
@@ -18,9 +18,22 @@
 #include <fcntl.h>
 #include <unistd.h>
 
+#include <algorithm>
+#include <array>
+#include <bitset>
+#include <memory>
+#include <numeric>
+#include <vector>
+
 #include <android-base/logging.h>
 #include <android-base/unique_fd.h>
 
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__aarch64__)
+#include <arm_neon.h>
+#endif
+
 #include "meminfo_private.h"
 
 using unique_fd = ::android::base::unique_fd;
@@ -77,33 +90,197 @@ bool PageAcct::InitPageAcct(bool pageidle_enable) {
 bool PageAcct::PageFlags(uint64_t pfn, uint64_t* flags) {
     if (!flags) return false;
 
-    if (kpageflags_fd_ < 0) {
-        if (!InitPageAcct()) return false;
-    }
+    return ReadPageAttrs(kPageFlags, {&pfn, 1}, {flags, 1});
+}
+
+bool PageAcct::PageMapCount(uint64_t pfn, uint64_t* mapcount) {
+    if (!mapcount) return false;
+
+    return ReadPageAttrs(kPageMapCount, {&pfn, 1}, {mapcount, 1});
+}
 
-    if (pread64(kpageflags_fd_, flags, sizeof(uint64_t), pfn * sizeof(uint64_t)) !=
-        sizeof(uint64_t)) {
-        PLOG(ERROR) << "Failed to read page flags for page " << pfn;
+// Page frames closer than this are fetched by the same read; the entries in
+// between are read and thrown away, which is cheaper than another syscall.
+static constexpr uint64_t kMaxPfnGap = 64;
+// Upper bound on the number of entries fetched by a single read.
+static constexpr uint64_t kMaxWindowPfns = 8192;
+
+// Resolves one uint64_t per page frame from 'fd' (either /proc/kpageflags or /proc/kpagecount)
+// into 'out'. The page frames are visited in sorted order so that each frame is read only once
+// and nearby frames are fetched with a single windowed read, then the results are scattered
+// back to the position the frame was requested at.
+static bool ReadPageAttrBatch(int fd, std::span<const uint64_t> pfns, std::span<uint64_t> out,
+                              const char* what) {
+    if (pfns.size() != out.size()) {
+        LOG(ERROR) << "Mismatched batch sizes while reading " << what << ": " << pfns.size()
+                   << " page frames, " << out.size() << " entries";
         return false;
     }
+
+    if (pfns.size() == 1) {
+        if (pread64(fd, &out[0], sizeof(uint64_t), pfns[0] * sizeof(uint64_t)) !=
+            sizeof(uint64_t)) {
+            PLOG(ERROR) << "Failed to read " << what << " for page " << pfns[0];
+            return false;
+        }
+        return true;
+    }
+
+    std::vector<size_t> order(pfns.size());
+    std::iota(order.begin(), order.end(), 0);
+    auto pfn_less = [&pfns](size_t a, size_t b) { return pfns[a] < pfns[b]; };
+    if (!std::is_sorted(order.begin(), order.end(), pfn_less)) {
+        std::sort(order.begin(), order.end(), pfn_less);
+    }
+
+    std::vector<uint64_t> window;
+    size_t i = 0;
+    while (i < order.size()) {
+        uint64_t first_pfn = pfns[order[i]];
+        uint64_t last_pfn = first_pfn;
+        size_t end = i + 1;
+        while (end < order.size()) {
+            uint64_t pfn = pfns[order[end]];
+            if (pfn - last_pfn > kMaxPfnGap || pfn - first_pfn >= kMaxWindowPfns) break;
+            last_pfn = pfn;
+            end++;
+        }
+
+        window.resize(last_pfn - first_pfn + 1);
+        size_t bytes_to_read = window.size() * sizeof(uint64_t);
+        ssize_t bytes = pread64(fd, window.data(), bytes_to_read, first_pfn * sizeof(uint64_t));
+        if (bytes != static_cast<ssize_t>(bytes_to_read)) {
+            PLOG(ERROR) << "Failed to read " << what << " for pages " << first_pfn << "-"
+                        << last_pfn;
+            return false;
+        }
+
+        for (; i < end; i++) {
+            out[order[i]] = window[pfns[order[i]] - first_pfn];
+        }
+    }
     return true;
 }
 
-bool PageAcct::PageMapCount(uint64_t pfn, uint64_t* mapcount) {
-    if (!mapcount) return false;
+// Sparse two-level table of page attributes indexed by page frame number. Leaves cover
+// 512 page frames each and are only allocated once a page frame in their range is stored.
+class PageAcct::PageAttrCache {
+  public:
+    bool Lookup(PageAttr attr, uint64_t pfn, uint64_t* val) const {
+        uint64_t index = pfn >> kLeafShift;
+        if (index >= leaves_.size() || !leaves_[index]) return false;
 
-    if (kpagecount_fd_ < 0) {
+        const Leaf& leaf = *leaves_[index];
+        uint64_t slot = pfn & (kLeafSize - 1);
+        if (!leaf.valid[attr].test(slot)) return false;
+
+        *val = leaf.vals[attr][slot];
+        return true;
+    }
+
+    void Store(PageAttr attr, uint64_t pfn, uint64_t val) {
+        uint64_t index = pfn >> kLeafShift;
+        if (index >= leaves_.size()) {
+            leaves_.resize(index + 1);
+        }
+        if (!leaves_[index]) {
+            leaves_[index] = std::make_unique<Leaf>();
+        }
+
+        Leaf& leaf = *leaves_[index];
+        uint64_t slot = pfn & (kLeafSize - 1);
+        leaf.vals[attr][slot] = val;
+        leaf.valid[attr].set(slot);
+    }
+
+  private:
+    static constexpr uint64_t kLeafShift = 9;
+    static constexpr uint64_t kLeafSize = 1ULL << kLeafShift;
+
+    struct Leaf {
+        std::array<uint64_t, kLeafSize> vals[kNumPageAttrs];
+        std::bitset<kLeafSize> valid[kNumPageAttrs];
+    };
+
+    std::vector<std::unique_ptr<Leaf>> leaves_;
+};
+
+PageAcct::PageAcct() : kpagecount_fd_(-1), kpageflags_fd_(-1), pageidle_fd_(-1), scan_depth_(0) {}
+
+PageAcct::~PageAcct() = default;
+
+void PageAcct::BeginScan() {
+    std::lock_guard<std::mutex> lock(scan_lock_);
+    if (scan_depth_++ == 0) {
+        scan_cache_ = std::make_unique<PageAttrCache>();
+    }
+}
+
+void PageAcct::EndScan() {
+    std::lock_guard<std::mutex> lock(scan_lock_);
+    if (scan_depth_ == 0) {
+        LOG(WARNING) << "EndScan() called without a matching BeginScan()";
+        return;
+    }
+    if (--scan_depth_ == 0) {
+        scan_cache_.reset();
+    }
+}
+
+bool PageAcct::ReadPageAttrs(PageAttr attr, std::span<const uint64_t> pfns,
+                             std::span<uint64_t> out) {
+    unique_fd& fd = (attr == kPageFlags) ? kpageflags_fd_ : kpagecount_fd_;
+    const char* what = (attr == kPageFlags) ? "page flags" : "map counts";
+    if (fd < 0) {
         if (!InitPageAcct()) return false;
     }
 
-    if (pread64(kpagecount_fd_, mapcount, sizeof(uint64_t), pfn * sizeof(uint64_t)) !=
-        sizeof(uint64_t)) {
-        PLOG(ERROR) << "Failed to read map count for page " << pfn;
+    std::unique_lock<std::mutex> lock(scan_lock_);
+    if (!scan_cache_) {
+        lock.unlock();
+        return ReadPageAttrBatch(fd, pfns, out, what);
+    }
+
+    if (pfns.size() != out.size()) {
+        LOG(ERROR) << "Mismatched batch sizes while reading " << what << ": " << pfns.size()
+                   << " page frames, " << out.size() << " entries";
         return false;
     }
+
+    // Only go to the kernel for the page frames this scan hasn't seen yet.
+    std::vector<size_t> miss_index;
+    std::vector<uint64_t> miss_pfns;
+    for (size_t i = 0; i < pfns.size(); i++) {
+        if (!scan_cache_->Lookup(attr, pfns[i], &out[i])) {
+            miss_index.emplace_back(i);
+            miss_pfns.emplace_back(pfns[i]);
+        }
+    }
+    if (miss_pfns.empty()) return true;
+
+    lock.unlock();
+    std::vector<uint64_t> miss_vals(miss_pfns.size());
+    if (!ReadPageAttrBatch(fd, miss_pfns, miss_vals, what)) return false;
+
+    lock.lock();
+    for (size_t i = 0; i < miss_pfns.size(); i++) {
+        out[miss_index[i]] = miss_vals[i];
+        // The scan may have ended while the kernel was being read.
+        if (scan_cache_) {
+            scan_cache_->Store(attr, miss_pfns[i], miss_vals[i]);
+        }
+    }
     return true;
 }
 
+bool PageAcct::PageFlagsBatch(std::span<const uint64_t> pfns, std::span<uint64_t> flags) {
+    return ReadPageAttrs(kPageFlags, pfns, flags);
+}
+
+bool PageAcct::PageMapCountBatch(std::span<const uint64_t> pfns, std::span<uint64_t> mapcounts) {
+    return ReadPageAttrs(kPageMapCount, pfns, mapcounts);
+}
+
 int PageAcct::IsPageIdle(uint64_t pfn) {
     if (pageidle_fd_ < 0) {
         if (!InitPageAcct(true)) return -EOPNOTSUPP;
@@ -115,6 +292,108 @@ int PageAcct::IsPageIdle(uint64_t pfn) {
     return GetPageIdle(pfn);
 }
 
+// Bitmap words closer than this are written or read together, the words in between are
+// all zero (writes) or thrown away (reads).
+static constexpr uint64_t kMaxIdleWordGap = 8;
+// The kernel handles at most a page worth of the bitmap per syscall, don't build bigger
+// windows than that.
+static constexpr uint64_t kMaxIdleWindowWords = 512;
+
+// Reads or writes 'words' at bitmap word 'first_word' of the page idle bitmap, continuing
+// after the partial transfers the kernel does for large requests.
+static bool IdleBitmapIo(int fd, bool write, std::span<uint64_t> words, uint64_t first_word) {
+    size_t done = 0;
+    size_t total = words.size_bytes();
+    uint8_t* buf = reinterpret_cast<uint8_t*>(words.data());
+    off64_t offset = first_word * sizeof(uint64_t);
+    while (done < total) {
+        ssize_t bytes = write ? pwrite64(fd, buf + done, total - done, offset + done)
+                              : pread64(fd, buf + done, total - done, offset + done);
+        if (bytes <= 0) {
+            PLOG(ERROR) << "Failed to " << (write ? "write" : "read")
+                        << " page idle bitmap for pages " << first_word * 64 << "-"
+                        << (first_word + words.size()) * 64 - 1;
+            return false;
+        }
+        done += bytes;
+    }
+    return true;
+}
+
+// Calls 'fn(first_word, last_word, begin, end)' for each window of the idle bitmap covering
+// the page frames sorted[begin, end).
+template <typename Fn>
+static bool ForEachIdleWindow(std::span<const uint64_t> sorted, Fn fn) {
+    size_t i = 0;
+    while (i < sorted.size()) {
+        uint64_t first_word = sorted[i] / 64;
+        uint64_t last_word = first_word;
+        size_t end = i + 1;
+        while (end < sorted.size()) {
+            uint64_t word = sorted[end] / 64;
+            if (word - last_word > kMaxIdleWordGap || word - first_word >= kMaxIdleWindowWords) {
+                break;
+            }
+            last_word = word;
+            end++;
+        }
+
+        if (!fn(first_word, last_word, i, end)) return false;
+        i = end;
+    }
+    return true;
+}
+
+bool PageAcct::MarkPagesIdle(std::span<const uint64_t> pfns) {
+    if (pageidle_fd_ < 0 && !InitPageAcct(true)) return false;
+
+    std::vector<uint64_t> sorted(pfns.begin(), pfns.end());
+    if (!std::is_sorted(sorted.begin(), sorted.end())) {
+        std::sort(sorted.begin(), sorted.end());
+    }
+
+    std::vector<uint64_t> window;
+    return ForEachIdleWindow(sorted, [&](uint64_t first_word, uint64_t last_word, size_t begin,
+                                         size_t end) {
+        window.assign(last_word - first_word + 1, 0);
+        for (size_t i = begin; i < end; i++) {
+            window[sorted[i] / 64 - first_word] |= 1ULL << (sorted[i] % 64);
+        }
+        return IdleBitmapIo(pageidle_fd_, true, window, first_word);
+    });
+}
+
+bool PageAcct::GetPagesIdle(std::span<const uint64_t> pfns, std::span<uint8_t> idle) {
+    if (pfns.size() != idle.size()) {
+        LOG(ERROR) << "Mismatched batch sizes while reading page idle bitmap: " << pfns.size()
+                   << " page frames, " << idle.size() << " entries";
+        return false;
+    }
+    if (pageidle_fd_ < 0 && !InitPageAcct(true)) return false;
+
+    std::vector<size_t> order(pfns.size());
+    std::iota(order.begin(), order.end(), 0);
+    auto pfn_less = [&pfns](size_t a, size_t b) { return pfns[a] < pfns[b]; };
+    if (!std::is_sorted(order.begin(), order.end(), pfn_less)) {
+        std::sort(order.begin(), order.end(), pfn_less);
+    }
+    std::vector<uint64_t> sorted(order.size());
+    for (size_t i = 0; i < order.size(); i++) {
+        sorted[i] = pfns[order[i]];
+    }
+
+    std::vector<uint64_t> window;
+    return ForEachIdleWindow(sorted, [&](uint64_t first_word, uint64_t last_word, size_t begin,
+                                         size_t end) {
+        window.resize(last_word - first_word + 1);
+        if (!IdleBitmapIo(pageidle_fd_, false, window, first_word)) return false;
+        for (size_t i = begin; i < end; i++) {
+            idle[order[i]] = !!(window[sorted[i] / 64 - first_word] & (1ULL << (sorted[i] % 64)));
+        }
+        return true;
+    });
+}
+
 int PageAcct::MarkPageIdle(uint64_t pfn) const {
     off64_t offset = pfn_to_idle_bitmap_offset(pfn);
     // set the bit corresponding to page frame
@@ -149,9 +428,84 @@ bool page_swapped(uint64_t pagemap_val) {
     return PAGE_SWAPPED(pagemap_val);
 }
 
+bool page_soft_dirty(uint64_t pagemap_val) {
+    return PAGE_SOFT_DIRTY(pagemap_val);
+}
+
 uint64_t page_pfn(uint64_t pagemap_val) {
     return PAGE_PFN(pagemap_val);
 }
 
+// Sets bit i of 'present' and 'swapped' from bits 63 and 62 of entries[i], for up to 64 entries.
+static void ClassifyPageMapBlock(const uint64_t* entries, size_t nr_entries, uint64_t* present,
+                                 uint64_t* swapped) {
+    uint64_t present_bits = 0;
+    uint64_t swapped_bits = 0;
+    size_t i = 0;
+#if defined(__AVX2__)
+    for (; i + 4 <= nr_entries; i += 4) {
+        __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(entries + i));
+        // movemask picks the top bit of each lane, shift the swapped bit up there.
+        uint64_t p = _mm256_movemask_pd(_mm256_castsi256_pd(v));
+        uint64_t s = _mm256_movemask_pd(_mm256_castsi256_pd(_mm256_slli_epi64(v, 1)));
+        present_bits |= p << i;
+        swapped_bits |= s << i;
+    }
+#elif defined(__aarch64__)
+    // Wholly absent blocks (reserved regions, guard pages) are common, check for them first.
+    uint64x2_t any = vdupq_n_u64(0);
+    for (size_t j = 0; j + 2 <= nr_entries; j += 2) {
+        any = vorrq_u64(any, vld1q_u64(entries + j));
+    }
+    uint64_t any_bits = vgetq_lane_u64(any, 0) | vgetq_lane_u64(any, 1);
+    if (nr_entries % 2) {
+        any_bits |= entries[nr_entries - 1];
+    }
+    if ((any_bits >> 62) == 0) {
+        *present = 0;
+        *swapped = 0;
+        return;
+    }
+    for (; i + 2 <= nr_entries; i += 2) {
+        uint64x2_t bits = vshrq_n_u64(vld1q_u64(entries + i), 62);
+        uint64_t lo = vgetq_lane_u64(bits, 0);
+        uint64_t hi = vgetq_lane_u64(bits, 1);
+        present_bits |= ((lo >> 1) | ((hi >> 1) << 1)) << i;
+        swapped_bits |= ((lo & 1) | ((hi & 1) << 1)) << i;
+    }
+#endif
+    for (; i < nr_entries; i++) {
+        present_bits |= PAGE_PRESENT(entries[i]) << i;
+        swapped_bits |= PAGE_SWAPPED(entries[i]) << i;
+    }
+    // The kernel never reports both, but swapped wins like it does everywhere else.
+    *present = present_bits & ~swapped_bits;
+    *swapped = swapped_bits;
+}
+
+bool ClassifyPageMap(std::span<const uint64_t> entries, std::span<uint64_t> present_mask,
+                     std::span<uint64_t> swapped_mask, std::span<uint64_t> pfns,
+                     size_t* nr_present, size_t* nr_swapped) {
+    size_t nr_words = (entries.size() + 63) / 64;
+    if (present_mask.size() < nr_words || swapped_mask.size() < nr_words ||
+        pfns.size() < entries.size()) {
+        LOG(ERROR) << "Not enough room to classify " << entries.size() << " pagemap entries";
+        return false;
+    }
+
+    *nr_present = 0;
+    *nr_swapped = 0;
+    for (size_t w = 0; w < nr_words; w++) {
+        size_t first = w * 64;
+        ClassifyPageMapBlock(entries.data() + first, std::min<size_t>(64, entries.size() - first),
+                             &present_mask[w], &swapped_mask[w]);
+        *nr_swapped += __builtin_popcountll(swapped_mask[w]);
+        for (uint64_t bits = present_mask[w]; bits; bits &= bits - 1) {
+            pfns[(*nr_present)++] = PAGE_PFN(entries[first + __builtin_ctzll(bits)]);
+        }
+    }
+    return true;
+}
+
 }  // namespace meminfo
 }  // namespace android
@@ -19,13 +19,20 @@
 #include <inttypes.h>
 #include <linux/kernel-page-flags.h>
 #include <stdio.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
 #include <unistd.h>
 
+#include <algorithm>
 #include <atomic>
+#include <chrono>
 #include <fstream>
 #include <iostream>
 #include <memory>
 #include <string>
+#include <string_view>
+#include <thread>
 #include <utility>
 #include <vector>
 
@@ -37,6 +44,7 @@
 #include <procinfo/process_map.h>
 
 #include "meminfo_private.h"
+#include "smapsparser.h"
 
 namespace android {
 namespace meminfo {
@@ -51,111 +59,6 @@ static const std::vector<std::string> g_excluded_vmas = {
 #endif
 };
 
-static void add_mem_usage(MemUsage* to, const MemUsage& from) {
-    to->vss += from.vss;
-    to->rss += from.rss;
-    to->pss += from.pss;
-    to->uss += from.uss;
-
-    to->swap += from.swap;
-
-    to->private_clean += from.private_clean;
-    to->private_dirty += from.private_dirty;
-
-    to->shared_clean += from.shared_clean;
-    to->shared_dirty += from.shared_dirty;
-}
-
-// Converts MemUsage stats from KB to B in case usage is expected in bytes.
-static void convert_usage_kb_to_b(MemUsage& usage) {
-    // These stats are only populated if /proc/<pid>/smaps is read, so they are excluded:
-    // swap_pss, anon_huge_pages, shmem_pmdmapped, file_pmd_mapped, shared_hugetlb, private_hugetlb.
-    constexpr int conversion_factor = 1024;
-    usage.vss *= conversion_factor;
-    usage.rss *= conversion_factor;
-    usage.pss *= conversion_factor;
-    usage.uss *= conversion_factor;
-
-    usage.swap *= conversion_factor;
-
-    usage.private_clean *= conversion_factor;
-    usage.private_dirty *= conversion_factor;
-
-    usage.shared_clean *= conversion_factor;
-    usage.shared_dirty *= conversion_factor;
-
-    usage.thp *= conversion_factor;
-}
-
-// Returns true if the line was valid smaps stats line false otherwise.
-static bool parse_smaps_field(const char* line, MemUsage* stats) {
-    const char *end = line;
-
-    // https://lore.kernel.org/patchwork/patch/1088579/ introduced tabs. Handle this case as well.
-    while (*end && !isspace(*end)) end++;
-    if (*end && end > line && *(end - 1) == ':') {
-        const char* c = end;
-        while (isspace(*c)) c++;
-        switch (line[0]) {
-            case 'P':
-                if (strncmp(line, "Pss:", 4) == 0) {
-                    stats->pss = strtoull(c, nullptr, 10);
-                } else if (strncmp(line, "Private_Clean:", 14) == 0) {
-                    uint64_t prcl = strtoull(c, nullptr, 10);
-                    stats->private_clean = prcl;
-                    stats->uss += prcl;
-                } else if (strncmp(line, "Private_Dirty:", 14) == 0) {
-                    uint64_t prdi = strtoull(c, nullptr, 10);
-                    stats->private_dirty = prdi;
-                    stats->uss += prdi;
-                } else if (strncmp(line, "Private_Hugetlb:", 16) == 0) {
-                    stats->private_hugetlb = strtoull(c, nullptr, 10);
-                }
-                break;
-            case 'S':
-                if (strncmp(line, "Size:", 5) == 0) {
-                    stats->vss = strtoull(c, nullptr, 10);
-                } else if (strncmp(line, "Shared_Clean:", 13) == 0) {
-                    stats->shared_clean = strtoull(c, nullptr, 10);
-                } else if (strncmp(line, "Shared_Dirty:", 13) == 0) {
-                    stats->shared_dirty = strtoull(c, nullptr, 10);
-                } else if (strncmp(line, "Swap:", 5) == 0) {
-                    stats->swap = strtoull(c, nullptr, 10);
-                } else if (strncmp(line, "SwapPss:", 8) == 0) {
-                    stats->swap_pss = strtoull(c, nullptr, 10);
-                } else if (strncmp(line, "ShmemPmdMapped:", 15) == 0) {
-                    stats->shmem_pmd_mapped = strtoull(c, nullptr, 10);
-                } else if (strncmp(line, "Shared_Hugetlb:", 15) == 0) {
-                    stats->shared_hugetlb = strtoull(c, nullptr, 10);
-                }
-                break;
-            case 'R':
-                if (strncmp(line, "Rss:", 4) == 0) {
-                    stats->rss = strtoull(c, nullptr, 10);
-                }
-                break;
-            case 'A':
-                if (strncmp(line, "AnonHugePages:", 14) == 0) {
-                    stats->anon_huge_pages = strtoull(c, nullptr, 10);
-                }
-                break;
-            case 'F':
-                if (strncmp(line, "FilePmdMapped:", 14) == 0) {
-                    stats->file_pmd_mapped = strtoull(c, nullptr, 10);
-                }
-                break;
-            case 'L':
-                if (strncmp(line, "Locked:", 7) == 0) {
-                    stats->locked = strtoull(c, nullptr, 10);
-                }
-                break;
-        }
-        return true;
-    }
-
-    return false;
-}
-
 bool ProcMemInfo::ResetWorkingSet(pid_t pid) {
     std::string clear_refs_path = ::android::base::StringPrintf("/proc/%d/clear_refs", pid);
     if (!::android::base::WriteStringToFile("1\n", clear_refs_path)) {
@@ -166,8 +69,76 @@ bool ProcMemInfo::ResetWorkingSet(pid_t pid) {
     return true;
 }
 
+bool ProcMemInfo::KernelHasSoftDirty() {
+    // Without CONFIG_MEM_SOFT_DIRTY, clear_refs still accepts "4" and the soft-dirty bit is
+    // never set, so check that a page this process just wrote is reported as soft-dirty.
+    static const bool has_soft_dirty = [] {
+        size_t pagesize = getpagesize();
+        void* page = mmap(nullptr, pagesize, PROT_READ | PROT_WRITE,
+                          MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (page == MAP_FAILED) {
+            return false;
+        }
+        *static_cast<volatile uint8_t*>(page) = 1;
+
+        uint64_t page_info = 0;
+        ::android::base::unique_fd fd(
+                TEMP_FAILURE_RETRY(open("/proc/self/pagemap", O_RDONLY | O_CLOEXEC)));
+        off64_t offset = reinterpret_cast<uintptr_t>(page) / pagesize * sizeof(page_info);
+        bool ret = fd != -1 &&
+                   pread64(fd, &page_info, sizeof(page_info), offset) == sizeof(page_info) &&
+                   PAGE_SOFT_DIRTY(page_info);
+        munmap(page, pagesize);
+        return ret;
+    }();
+    return has_soft_dirty;
+}
+
+bool ProcMemInfo::ResetSoftDirty(std::span<const pid_t> pids) {
+    if (!KernelHasSoftDirty()) {
+        LOG(ERROR) << "Missing support for soft-dirty tracking in the kernel";
+        return false;
+    }
+
+    bool ret = true;
+    for (pid_t pid : pids) {
+        std::string clear_refs_path = ::android::base::StringPrintf("/proc/%d/clear_refs", pid);
+        if (!::android::base::WriteStringToFile("4\n", clear_refs_path)) {
+            PLOG(ERROR) << "Failed to write to " << clear_refs_path;
+            ret = false;
+        }
+    }
+
+    return ret;
+}
+
+bool ProcMemInfo::SoftDirtyWss(std::span<const pid_t> pids, std::span<MemUsage> wss) {
+    if (pids.size() != wss.size()) {
+        LOG(ERROR) << "Mismatched sizes while reading write working sets: " << pids.size()
+                   << " processes, " << wss.size() << " entries";
+        return false;
+    }
+
+    bool ret = true;
+    for (size_t i = 0; i < pids.size(); i++) {
+        ProcMemInfo proc_mem(pids[i], true);
+        if (!proc_mem.ReadSoftDirtyStats()) {
+            wss[i] = {};
+            ret = false;
+            continue;
+        }
+        wss[i] = proc_mem.usage_;
+    }
+
+    return ret;
+}
+
 ProcMemInfo::ProcMemInfo(pid_t pid, bool get_wss, uint64_t pgflags, uint64_t pgflags_mask)
-    : pid_(pid), get_wss_(get_wss), pgflags_(pgflags), pgflags_mask_(pgflags_mask) {}
+    : pid_(pid),
+      get_wss_(get_wss),
+      pgflags_(pgflags),
+      pgflags_mask_(pgflags_mask),
+      usage_stats_threads_(1) {}
 
 const std::vector<Vma>& ProcMemInfo::Maps() {
     if (maps_.empty() && !ReadMaps(get_wss_)) {
@@ -185,6 +156,14 @@ const std::vector<Vma>& ProcMemInfo::MapsWithPageIdle() {
     return maps_;
 }
 
+const std::vector<Vma>& ProcMemInfo::MapsWithSoftDirty() {
+    if (maps_.empty() && !ReadSoftDirtyStats()) {
+        LOG(ERROR) << "Failed to read maps with soft-dirty for Process " << pid_;
+    }
+
+    return maps_;
+}
+
 const std::vector<Vma>& ProcMemInfo::MapsWithoutUsageStats() {
     if (maps_.empty() && !ReadMaps(get_wss_, false, false)) {
         LOG(ERROR) << "Failed to read maps for Process " << pid_;
@@ -193,6 +172,9 @@ const std::vector<Vma>& ProcMemInfo::MapsWithoutUsageStats() {
     return maps_;
 }
 
+// Number of page map entries read at once outside of a session.
+static constexpr size_t kMaxPages = 2048;
+
 static int GetPagemapFd(pid_t pid) {
     std::string pagemap_file = ::android::base::StringPrintf("/proc/%d/pagemap", pid);
     int fd = TEMP_FAILURE_RETRY(open(pagemap_file.c_str(), O_RDONLY | O_CLOEXEC));
@@ -202,15 +184,173 @@ static int GetPagemapFd(pid_t pid) {
     return fd;
 }
 
+static std::atomic<bool> g_pagemap_scan_unsupported = false;
+
+// Uses the PAGEMAP_SCAN ioctl to find the pages in [first_page, last_page) that are in any of
+// 'categories' (PAGE_IS_* flags) and stores them as [start, end) page runs in 'runs', merging
+// runs that abut. Returns false if the kernel can't do the scan, in which case the caller is
+// expected to read the page map entries of the whole range instead.
+static bool ScanPageRuns(int pagemap_fd, size_t first_page, size_t last_page, uint64_t categories,
+                         std::vector<std::pair<size_t, size_t>>* runs) {
+    runs->clear();
+    if (g_pagemap_scan_unsupported.load(std::memory_order_relaxed)) {
+        return false;
+    }
+
+    static constexpr size_t kMaxRegions = 256;
+    struct page_region regions[kMaxRegions];
+    uint64_t pagesize = getpagesize();
+
+    struct pm_scan_arg arg = {};
+    arg.size = sizeof(arg);
+    arg.start = first_page * pagesize;
+    arg.end = last_page * pagesize;
+    arg.vec = reinterpret_cast<uintptr_t>(regions);
+    arg.vec_len = kMaxRegions;
+    arg.category_anyof_mask = categories;
+    arg.return_mask = categories;
+    while (arg.start < arg.end) {
+        int nr_regions = ioctl(pagemap_fd, PAGEMAP_SCAN, &arg);
+        if (nr_regions < 0) {
+            if (errno == ENOTTY || errno == EOPNOTSUPP) {
+                g_pagemap_scan_unsupported.store(true, std::memory_order_relaxed);
+            } else {
+                PLOG(WARNING) << "PAGEMAP_SCAN failed, reading the whole page map range instead";
+            }
+            runs->clear();
+            return false;
+        }
+
+        for (int i = 0; i < nr_regions; i++) {
+            size_t run_start = regions[i].start / pagesize;
+            size_t run_end = regions[i].end / pagesize;
+            if (!runs->empty() && runs->back().second == run_start) {
+                runs->back().second = run_end;
+            } else {
+                runs->emplace_back(run_start, run_end);
+            }
+        }
+
+        // The kernel stops early when 'regions' fills up and tells us where it got to.
+        if (arg.walk_end <= arg.start) {
+            LOG(WARNING) << "PAGEMAP_SCAN made no progress at 0x" << std::hex << arg.start;
+            runs->clear();
+            return false;
+        }
+        arg.start = arg.walk_end;
+    }
+
+    return true;
+}
+
+// Reads the page map entries of pages [first_page, last_page) in chunks of up to 'max_pages'
+// into 'page_cache' (a local buffer if null) and calls 'fn' with the page number of the first
+// entry of each chunk and the chunk, and fails if 'fn' returns false. Only pages in any of
+// 'categories' need to be visited, so when the kernel can point those out the entries of all
+// other pages are not read at all.
+template <typename Fn>
+static bool ForEachPageMapEntryChunk(int pagemap_fd, size_t first_page, size_t last_page,
+                                     uint64_t categories, std::vector<uint64_t>* page_cache,
+                                     size_t max_pages, Fn fn) {
+    std::vector<std::pair<size_t, size_t>> runs;
+    if (!ScanPageRuns(pagemap_fd, first_page, last_page, categories, &runs)) {
+        runs.assign(1, {first_page, last_page});
+    }
+
+    std::vector<uint64_t> local_cache;
+    if (!page_cache) {
+        page_cache = &local_cache;
+    }
+    for (const auto& [run_start, run_end] : runs) {
+        for (size_t cur_page = run_start; cur_page < run_end; cur_page += page_cache->size()) {
+            // Cache page map data.
+            page_cache->resize(std::min(max_pages, run_end - cur_page));
+            size_t total_bytes = page_cache->size() * sizeof(uint64_t);
+            ssize_t bytes = pread64(pagemap_fd, page_cache->data(), total_bytes,
+                                    cur_page * sizeof(uint64_t));
+            if (bytes != total_bytes) {
+                if (bytes == -1) {
+                    PLOG(ERROR) << "Failed to read page data at offset 0x" << std::hex
+                                << cur_page * sizeof(uint64_t);
+                } else {
+                    LOG(ERROR) << "Failed to read page data at offset 0x" << std::hex
+                               << cur_page * sizeof(uint64_t) << std::dec << " read bytes "
+                               << bytes << " expected bytes " << total_bytes;
+                }
+                return false;
+            }
+
+            if (!fn(cur_page, std::span<const uint64_t>(*page_cache))) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+// Same as above, but calls 'fn' with the page number and page map entry of each page.
+template <typename Fn>
+static bool ForEachPageMapEntry(int pagemap_fd, size_t first_page, size_t last_page,
+                                uint64_t categories, std::vector<uint64_t>* page_cache,
+                                size_t max_pages, Fn fn) {
+    return ForEachPageMapEntryChunk(pagemap_fd, first_page, last_page, categories, page_cache,
+                                    max_pages,
+                                    [&](size_t chunk_page, std::span<const uint64_t> entries) {
+                                        for (size_t i = 0; i < entries.size(); i++) {
+                                            fn(chunk_page + i, entries[i]);
+                                        }
+                                        return true;
+                                    });
+}
+
+bool ProcMemInfo::BeginSession(size_t max_buffer_bytes) {
+    if (session_.pagemap_fd != -1) {
+        LOG(ERROR) << "Session for process " << pid_ << " already started";
+        return false;
+    }
+
+    ::android::base::unique_fd pagemap_fd(GetPagemapFd(pid_));
+    if (pagemap_fd == -1) {
+        return false;
+    }
+
+    session_.pagemap_fd = std::move(pagemap_fd);
+    session_.max_pages = std::max<size_t>(max_buffer_bytes / sizeof(uint64_t), 1);
+    session_.page_cache.reserve(session_.max_pages);
+    return true;
+}
+
+void ProcMemInfo::EndSession() {
+    session_ = Session();
+}
+
+int ProcMemInfo::PagemapFd(::android::base::unique_fd* fd) const {
+    if (session_.pagemap_fd != -1) {
+        return session_.pagemap_fd.get();
+    }
+
+    fd->reset(GetPagemapFd(pid_));
+    return fd->get();
+}
+
+std::vector<uint64_t>* ProcMemInfo::SessionPageCache() {
+    return session_.pagemap_fd != -1 ? &session_.page_cache : nullptr;
+}
+
+size_t ProcMemInfo::SessionMaxPages() const {
+    return session_.pagemap_fd != -1 ? session_.max_pages : kMaxPages;
+}
+
 const std::vector<Vma>& ProcMemInfo::Smaps(const std::string& path, bool collect_usage,
                                            bool collect_swap_offsets) {
     if (!maps_.empty()) {
         return maps_;
     }
 
-    ::android::base::unique_fd pagemap_fd;
+    ::android::base::unique_fd owned_fd;
+    int pagemap_fd = -1;
     if (collect_swap_offsets) {
-        pagemap_fd = ::android::base::unique_fd(GetPagemapFd(pid_));
+        pagemap_fd = PagemapFd(&owned_fd);
         if (pagemap_fd == -1) {
             LOG(ERROR) << "Failed to open pagemap for pid " << pid_ << " during Smaps()";
             return maps_;
@@ -222,10 +362,10 @@ const std::vector<Vma>& ProcMemInfo::Smaps(const std::string& path, bool collect
                 g_excluded_vmas.end()) {
             maps_.emplace_back(vma);
             if (collect_usage) {
-                add_mem_usage(&usage_, vma.usage);
+                usage_ += vma.usage;
             }
             if (collect_swap_offsets &&
-                !ReadVmaStats(pagemap_fd.get(), vma, false, false, false, false)) {
+                !ReadVmaStats(pagemap_fd, vma, false, false, false, false)) {
                 LOG(ERROR) << "Failed to read page map for vma " << vma.name << "[" << vma.start
                            << "-" << vma.end << "]";
                 return false;
@@ -275,61 +415,30 @@ const MemUsage& ProcMemInfo::Wss() {
     return usage_;
 }
 
+// The std::function overloads are kept for existing callers; they are the templated ones
+// called through the std::function.
 bool ProcMemInfo::ForEachVma(const VmaCallback& callback, bool use_smaps) {
-    std::string path =
-            ::android::base::StringPrintf("/proc/%d/%s", pid_, use_smaps ? "smaps" : "maps");
-    return ForEachVmaFromFile(path, callback, use_smaps);
+    return ForEachVma<const VmaCallback&>(callback, use_smaps);
 }
 
 bool ProcMemInfo::ForEachExistingVma(const VmaCallback& callback) {
-    if (maps_.empty()) {
-        return false;
-    }
-    for (auto& vma : maps_) {
-        if (!callback(vma)) {
-            return false;
-        }
-    }
-    return true;
+    return ForEachExistingVma<const VmaCallback&>(callback);
 }
 
 bool ProcMemInfo::ForEachVmaFromMaps(const VmaCallback& callback) {
-    Vma vma;
-    auto vmaCollect = [&callback,&vma](const uint64_t start, uint64_t end, uint16_t flags,
-                            uint64_t pgoff, ino_t inode, const char* name, bool shared) {
-        vma.start = start;
-        vma.end = end;
-        vma.flags = flags;
-        vma.offset = pgoff;
-        vma.name = name;
-        vma.inode = inode;
-        vma.is_shared = shared;
-        callback(vma);
-    };
-
-    bool success = ::android::procinfo::ReadProcessMaps(pid_, vmaCollect);
-
-    return success;
+    return ForEachVmaFromMaps<const VmaCallback&>(callback);
 }
 
 bool ProcMemInfo::ForEachVmaFromMaps(const VmaCallback& callback, std::string& mapsBuffer) {
-    Vma vma;
-    vma.name.reserve(256);
-    auto vmaCollect = [&callback,&vma](const uint64_t start, uint64_t end, uint16_t flags,
-                            uint64_t pgoff, ino_t inode, const char* name, bool shared) {
-        vma.start = start;
-        vma.end = end;
-        vma.flags = flags;
-        vma.offset = pgoff;
-        vma.name = name;
-        vma.inode = inode;
-        vma.is_shared = shared;
-        callback(vma);
-    };
-
-    bool success = ::android::procinfo::ReadProcessMaps(pid_, vmaCollect, mapsBuffer);
+    return ForEachVmaFromMaps<const VmaCallback&>(callback, mapsBuffer);
+}
 
-    return success;
+// Sets 'path' to /proc/<pid>/<file>, reusing its storage.
+static const std::string& ProcPidPath(std::string* path, pid_t pid, const char* file) {
+    char buf[64];
+    snprintf(buf, sizeof(buf), "/proc/%d/%s", pid, file);
+    path->assign(buf);
+    return *path;
 }
 
 bool ProcMemInfo::SmapsOrRollup(MemUsage* stats) const {
@@ -338,41 +447,134 @@ bool ProcMemInfo::SmapsOrRollup(MemUsage* stats) const {
     return SmapsOrRollupFromFile(path, stats);
 }
 
+bool ProcMemInfo::SmapsOrRollup(MemUsage* stats, ParseContext& ctx) const {
+    const char* file = IsSmapsRollupSupported() ? "smaps_rollup" : "smaps";
+    return SmapsOrRollupFromFile(ProcPidPath(&ctx.path, pid_, file), stats, ctx);
+}
+
 bool ProcMemInfo::SmapsOrRollupPss(uint64_t* pss) const {
     std::string path = ::android::base::StringPrintf(
             "/proc/%d/%s", pid_, IsSmapsRollupSupported() ? "smaps_rollup" : "smaps");
     return SmapsOrRollupPssFromFile(path, pss);
 }
 
+bool ProcMemInfo::SmapsOrRollupPss(uint64_t* pss, ParseContext& ctx) const {
+    const char* file = IsSmapsRollupSupported() ? "smaps_rollup" : "smaps";
+    return SmapsOrRollupPssFromFile(ProcPidPath(&ctx.path, pid_, file), pss, ctx);
+}
+
+static SmapsReadStatus SmapsReadStatusFromErrno(int err) {
+    switch (err) {
+        case ENOENT:
+        case ESRCH:
+            return SmapsReadStatus::kGone;
+        case EACCES:
+        case EPERM:
+            return SmapsReadStatus::kPermissionDenied;
+        default:
+            return SmapsReadStatus::kError;
+    }
+}
+
+bool ProcMemInfo::SmapsOrRollupBatch(std::span<const pid_t> pids, std::span<MemUsage> stats,
+                                     std::span<SmapsReadStatus> status,
+                                     const SmapsOrRollupBatchOptions& options) {
+    if (pids.size() != stats.size() || (!status.empty() && status.size() != pids.size())) {
+        LOG(ERROR) << "Mismatched sizes while reading smaps: " << pids.size() << " processes, "
+                   << stats.size() << " entries, " << status.size() << " statuses";
+        return false;
+    }
+
+    const char* file = IsSmapsRollupSupported() ? "smaps_rollup" : "smaps";
+    std::atomic<size_t> next_pid = 0;
+    std::atomic<bool> failed = false;
+    auto worker = [&]() {
+        ParseContext ctx;
+        for (size_t i = next_pid++; i < pids.size(); i = next_pid++) {
+            SmapsReadStatus result = SmapsReadStatus::kOk;
+            if (std::chrono::steady_clock::now() >= options.deadline) {
+                result = SmapsReadStatus::kDeadlineExceeded;
+            } else if (!SmapsOrRollupFromFile(ProcPidPath(&ctx.path, pids[i], file), &stats[i],
+                                              ctx)) {
+                result = SmapsReadStatusFromErrno(errno);
+            }
+            if (result != SmapsReadStatus::kOk) {
+                stats[i] = {};
+                failed = true;
+            }
+            if (!status.empty()) {
+                status[i] = result;
+            }
+        }
+    };
+
+    // The calling thread is one of the workers.
+    size_t num_threads = std::min<size_t>(options.num_threads, pids.size());
+    std::vector<std::thread> threads;
+    for (size_t i = 1; i < num_threads; i++) {
+        threads.emplace_back(worker);
+    }
+    worker();
+    for (auto& thread : threads) {
+        thread.join();
+    }
+
+    return !failed;
+}
+
 bool ProcMemInfo::StatusVmRSS(uint64_t* rss) const {
     std::string path = ::android::base::StringPrintf("/proc/%d/status", pid_);
     return StatusVmRSSFromFile(path, rss);
 }
 
+bool ProcMemInfo::StatusVmRSS(uint64_t* rss, ParseContext& ctx) const {
+    return StatusVmRSSFromFile(ProcPidPath(&ctx.path, pid_, "status"), rss);
+}
+
+bool ProcMemInfo::Status(uint32_t fields, ProcStatus* status) const {
+    char path[64];
+    snprintf(path, sizeof(path), "/proc/%d/status", pid_);
+    return ProcStatusFromFile(path, fields, status);
+}
+
 const std::vector<uint64_t>& ProcMemInfo::SwapOffsets() {
+    const SwapSlotList& swap_slots = SwapSlots();
+    swap_offsets_.clear();
+    swap_offsets_.reserve(swap_slots.size());
+    swap_slots.ForEach([this](uint32_t, uint64_t offset) { swap_offsets_.emplace_back(offset); });
+    return swap_offsets_;
+}
+
+const SwapSlotList& ProcMemInfo::SwapSlots() {
     if (get_wss_) {
         LOG(WARNING) << "Trying to read process swap offsets for " << pid_
                      << " using invalid object";
-        return swap_offsets_;
+        return swap_slot_list_;
     }
 
     if (maps_.empty() && !ReadMaps(get_wss_, false, true, false)) {
         LOG(ERROR) << "Failed to get swap offsets for Process " << pid_;
     }
 
-    return swap_offsets_;
+    // Slots are collected as they are found, and only packed when asked for.
+    if (!swap_slots_.empty()) {
+        swap_slot_list_.Append(&swap_slots_);
+        swap_slots_.clear();
+        swap_slots_.shrink_to_fit();
+    }
+    return swap_slot_list_;
 }
 
 bool ProcMemInfo::PageMap(const Vma& vma, std::vector<uint64_t>* pagemap) {
     pagemap->clear();
-    std::string pagemap_file = ::android::base::StringPrintf("/proc/%d/pagemap", pid_);
-    ::android::base::unique_fd pagemap_fd(
-            TEMP_FAILURE_RETRY(open(pagemap_file.c_str(), O_RDONLY | O_CLOEXEC)));
+    ::android::base::unique_fd owned_fd;
+    int pagemap_fd = PagemapFd(&owned_fd);
     if (pagemap_fd == -1) {
-        PLOG(ERROR) << "Failed to open " << pagemap_file;
         return false;
     }
 
+    // Every entry is read, as callers get the raw entries: pages that are neither present nor
+    // swapped may still carry bits, e.g. soft-dirty in VM_SOFTDIRTY vmas or uffd-wp.
     uint64_t nr_pages = (vma.end - vma.start) / getpagesize();
     pagemap->resize(nr_pages);
 
@@ -391,6 +593,64 @@ bool ProcMemInfo::PageMap(const Vma& vma, std::vector<uint64_t>* pagemap) {
     return true;
 }
 
+bool ProcMemInfo::ForEachPageMapChunk(const Vma& vma, const PageMapChunkCallback& callback,
+                                      std::span<uint64_t> buffer) {
+    return ForEachPageMapChunk({&vma, 1}, callback, buffer);
+}
+
+bool ProcMemInfo::ForEachPageMapChunk(std::span<const Vma> vmas,
+                                      const PageMapChunkCallback& callback,
+                                      std::span<uint64_t> buffer) {
+    ::android::base::unique_fd owned_fd;
+    int pagemap_fd = PagemapFd(&owned_fd);
+    if (pagemap_fd == -1) {
+        return false;
+    }
+
+    std::vector<uint64_t> local_buffer;
+    if (buffer.empty()) {
+        std::vector<uint64_t>* page_cache = SessionPageCache();
+        if (!page_cache) {
+            page_cache = &local_buffer;
+        }
+        page_cache->resize(SessionMaxPages());
+        buffer = *page_cache;
+    }
+
+    size_t pagesize = getpagesize();
+    size_t i = 0;
+    while (i < vmas.size()) {
+        size_t first_page = vmas[i].start / pagesize;
+        size_t last_page = vmas[i].end / pagesize;
+        for (i++; i < vmas.size() && vmas[i].start / pagesize == last_page; i++) {
+            last_page = vmas[i].end / pagesize;
+        }
+
+        for (size_t cur_page = first_page; cur_page < last_page;) {
+            size_t nr_pages = std::min(buffer.size(), last_page - cur_page);
+            size_t bytes_to_read = nr_pages * sizeof(uint64_t);
+            ssize_t bytes_read = pread64(pagemap_fd, buffer.data(), bytes_to_read,
+                                         cur_page * sizeof(uint64_t));
+            if (bytes_read == -1) {
+                PLOG(ERROR) << "Failed to read page frames from page map for pid: " << pid_;
+                return false;
+            } else if (static_cast<size_t>(bytes_read) != bytes_to_read) {
+                LOG(ERROR) << "Failed to read page frames from page map for pid: " << pid_
+                           << ": read bytes " << bytes_read << " expected bytes "
+                           << bytes_to_read;
+                return false;
+            }
+
+            if (!callback(buffer.first(nr_pages), cur_page * pagesize)) {
+                return false;
+            }
+            cur_page += nr_pages;
+        }
+    }
+
+    return true;
+}
+
 bool ProcMemInfo::ReadMaps(bool get_wss, bool use_pageidle, bool get_usage_stats,
                            bool update_mem_usage) {
     // Each object reads /proc/<pid>/maps only once. This is done to make sure programs that are
@@ -430,37 +690,249 @@ bool ProcMemInfo::ReadMaps(bool get_wss, bool use_pageidle, bool get_usage_stats
 }
 
 bool ProcMemInfo::GetUsageStats(bool get_wss, bool use_pageidle, bool update_mem_usage) {
-    ::android::base::unique_fd pagemap_fd(GetPagemapFd(pid_));
+    ::android::base::unique_fd owned_fd;
+    int pagemap_fd = PagemapFd(&owned_fd);
     if (pagemap_fd == -1) {
         return false;
     }
 
+    if (usage_stats_threads_ > 1) {
+        return GetUsageStatsParallel(pagemap_fd, get_wss, use_pageidle, update_mem_usage);
+    }
+
     for (auto& vma : maps_) {
-        if (!ReadVmaStats(pagemap_fd.get(), vma, get_wss, use_pageidle, update_mem_usage, true)) {
+        if (!ReadVmaStats(pagemap_fd, vma, get_wss, use_pageidle, update_mem_usage, true)) {
             LOG(ERROR) << "Failed to read page map for vma " << vma.name << "[" << vma.start << "-"
                        << vma.end << "]";
             return false;
         }
-        add_mem_usage(&usage_, vma.usage);
+        usage_ += vma.usage;
+    }
+
+    return true;
+}
+
+bool ProcMemInfo::GetUsageStatsParallel(int pagemap_fd, bool get_wss, bool use_pageidle,
+                                        bool update_mem_usage) {
+    // Open the kernel interfaces up front so the workers don't race to do it.
+    PageAcct& pinfo = PageAcct::Instance();
+    if (update_mem_usage && !pinfo.InitPageAcct(get_wss && use_pageidle)) {
+        LOG(ERROR) << "Failed to init page accounting";
+        return false;
+    }
+
+    // Each range collects its own stats and swap offsets, which are merged in order once all
+    // workers are done.
+    struct PageRange {
+        size_t vma_index;
+        size_t first_page;
+        size_t last_page;
+        MemUsage usage;
+        std::vector<uint64_t> swap_slots;
+    };
+    static constexpr size_t kMaxPagesPerRange = 8192;
+    std::vector<PageRange> ranges;
+    for (size_t i = 0; i < maps_.size(); i++) {
+        size_t first_page = maps_[i].start / getpagesize();
+        size_t last_page = maps_[i].end / getpagesize();
+        // Ranges end on multiples of kMaxPagesPerRange, so they don't split huge pages.
+        for (size_t page = first_page; page < last_page;) {
+            size_t range_end = (page / kMaxPagesPerRange + 1) * kMaxPagesPerRange;
+            ranges.push_back({.vma_index = i,
+                              .first_page = page,
+                              .last_page = std::min(range_end, last_page)});
+            page = ranges.back().last_page;
+        }
+    }
+
+    std::atomic<size_t> next_range = 0;
+    std::atomic<bool> failed = false;
+    auto worker = [&]() {
+        for (size_t i = next_range++; i < ranges.size() && !failed; i = next_range++) {
+            PageRange& range = ranges[i];
+            if (!ReadPageRangeStats(pagemap_fd, range.first_page, range.last_page, get_wss,
+                                    use_pageidle, update_mem_usage, true, &range.usage,
+                                    &range.swap_slots, nullptr)) {
+                const Vma& vma = maps_[range.vma_index];
+                LOG(ERROR) << "Failed to read page map for vma " << vma.name << "[" << vma.start
+                           << "-" << vma.end << "]";
+                failed = true;
+            }
+        }
+    };
+
+    // The calling thread is one of the workers.
+    size_t num_threads = std::min<size_t>(usage_stats_threads_, ranges.size());
+    std::vector<std::thread> threads;
+    for (size_t i = 1; i < num_threads; i++) {
+        threads.emplace_back(worker);
+    }
+    worker();
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    if (failed) {
+        return false;
+    }
+
+    for (auto& range : ranges) {
+        Vma& vma = maps_[range.vma_index];
+        vma.usage += range.usage;
+        swap_slots_.insert(swap_slots_.end(), range.swap_slots.begin(), range.swap_slots.end());
+    }
+    for (auto& vma : maps_) {
+        usage_ += vma.usage;
     }
 
     return true;
 }
 
 bool ProcMemInfo::FillInVmaStats(Vma& vma, bool use_kb) {
-    ::android::base::unique_fd pagemap_fd(GetPagemapFd(pid_));
+    ::android::base::unique_fd owned_fd;
+    int pagemap_fd = PagemapFd(&owned_fd);
     if (pagemap_fd == -1) {
         return false;
     }
 
-    if (!ReadVmaStats(pagemap_fd.get(), vma, get_wss_, false, true, true)) {
+    if (!ReadVmaStats(pagemap_fd, vma, get_wss_, false, true, true)) {
         LOG(ERROR) << "Failed to read page map for vma " << vma.name << "[" << vma.start << "-"
                    << vma.end << "]";
         return false;
     }
     if (!use_kb) {
-        convert_usage_kb_to_b(vma.usage);
+        vma.usage *= 1024;
+    }
+    return true;
+}
+
+bool ProcMemInfo::UsageFromPageMap(MemUsage* usage, bool read_page_flags) {
+    *usage = {};
+    if (maps_.empty() && !ReadMaps(get_wss_, false, false)) {
+        LOG(ERROR) << "Failed to read maps for Process " << pid_;
+        return false;
+    }
+
+    ::android::base::unique_fd owned_fd;
+    int pagemap_fd = PagemapFd(&owned_fd);
+    if (pagemap_fd == -1) {
+        return false;
+    }
+
+    // The page flags filter can only be applied with the flags at hand.
+    read_page_flags |= pgflags_mask_ != 0;
+
+    PageAcct& pinfo = PageAcct::Instance();
+    uint64_t pagesz_kb = getpagesize() / 1024;
+    // Page frames of present pages, with the exclusive bit of their page map entry, whose
+    // flags still need to be looked up.
+    std::vector<uint64_t> page_frames;
+    std::vector<bool> page_exclusive;
+    for (const Vma& vma : maps_) {
+        size_t first_page = vma.start / getpagesize();
+        size_t last_page = vma.end / getpagesize();
+        usage->vss += pagesz_kb * (last_page - first_page);
+
+        page_frames.clear();
+        page_exclusive.clear();
+        if (!ForEachPageMapEntry(pagemap_fd, first_page, last_page,
+                                 PAGE_IS_PRESENT | PAGE_IS_SWAPPED, SessionPageCache(),
+                                 SessionMaxPages(), [&](size_t, uint64_t page_info) {
+                                     if (PAGE_SWAPPED(page_info)) {
+                                         usage->swap += pagesz_kb;
+                                     } else if (!PAGE_PRESENT(page_info)) {
+                                         return;
+                                     } else if (read_page_flags) {
+                                         page_frames.emplace_back(PAGE_PFN(page_info));
+                                         page_exclusive.push_back(PAGE_EXCLUSIVE(page_info));
+                                     } else {
+                                         usage->rss += pagesz_kb;
+                                         usage->uss += PAGE_EXCLUSIVE(page_info) ? pagesz_kb : 0;
+                                     }
+                                 })) {
+            LOG(ERROR) << "Failed to read page map for vma " << vma.name << "[" << vma.start
+                       << "-" << vma.end << "]";
+            return false;
+        }
+
+        if (page_frames.empty()) {
+            continue;
+        }
+
+        std::vector<uint64_t> page_flags(page_frames.size());
+        if (!pinfo.PageFlagsBatch(page_frames, page_flags)) {
+            LOG(ERROR) << "Failed to get page flags for vma " << vma.name << "[" << vma.start
+                       << "-" << vma.end << "] in process " << pid_;
+            return false;
+        }
+
+        for (size_t i = 0; i < page_frames.size(); i++) {
+            if (KPAGEFLAG_THP(page_flags[i])) {
+                usage->thp += pagesz_kb;
+            }
+
+            if ((page_flags[i] & pgflags_mask_) != pgflags_) continue;
+
+            bool is_dirty = !!(page_flags[i] & (1 << KPF_DIRTY));
+            usage->rss += pagesz_kb;
+            if (page_exclusive[i]) {
+                usage->uss += pagesz_kb;
+                usage->private_dirty += is_dirty ? pagesz_kb : 0;
+                usage->private_clean += is_dirty ? 0 : pagesz_kb;
+            } else {
+                usage->shared_dirty += is_dirty ? pagesz_kb : 0;
+                usage->shared_clean += is_dirty ? 0 : pagesz_kb;
+            }
+        }
     }
+
+    return true;
+}
+
+bool ProcMemInfo::ReadSoftDirtyStats() {
+    if (!maps_.empty()) return true;
+    // Otherwise no page is ever soft-dirty, and the write working set would read as empty.
+    if (!KernelHasSoftDirty()) {
+        LOG(ERROR) << "Missing support for soft-dirty tracking in the kernel";
+        return false;
+    }
+    if (!ReadMaps(get_wss_, false, false)) {
+        return false;
+    }
+
+    ::android::base::unique_fd owned_fd;
+    int pagemap_fd = PagemapFd(&owned_fd);
+    if (pagemap_fd == -1) {
+        maps_.clear();
+        return false;
+    }
+
+    uint64_t pagesz_kb = getpagesize() / 1024;
+    for (Vma& vma : maps_) {
+        MemUsage& usage = vma.usage;
+        if (!ForEachPageMapEntry(pagemap_fd, vma.start / getpagesize(), vma.end / getpagesize(),
+                                 PAGE_IS_PRESENT | PAGE_IS_SWAPPED, SessionPageCache(),
+                                 SessionMaxPages(), [&](size_t, uint64_t page_info) {
+                                     if (!PAGE_SOFT_DIRTY(page_info)) return;
+
+                                     if (PAGE_SWAPPED(page_info)) {
+                                         usage.swap += pagesz_kb;
+                                     } else if (PAGE_PRESENT(page_info)) {
+                                         usage.vss += pagesz_kb;
+                                         usage.rss += pagesz_kb;
+                                         usage.uss +=
+                                                 PAGE_EXCLUSIVE(page_info) ? pagesz_kb : 0;
+                                     }
+                                 })) {
+            LOG(ERROR) << "Failed to read page map for vma " << vma.name << "[" << vma.start
+                       << "-" << vma.end << "]";
+            maps_.clear();
+            usage_.clear();
+            return false;
+        }
+
+        usage_ += usage;
+    }
+
     return true;
 }
 
@@ -472,184 +944,304 @@ bool ProcMemInfo::ReadVmaStats(int pagemap_fd, Vma& vma, bool get_wss, bool use_
         return false;
     }
 
-    uint64_t pagesz_kb = getpagesize() / 1024;
-    size_t num_pages = (vma.end - vma.start) / getpagesize();
     size_t first_page = vma.start / getpagesize();
+    size_t last_page = vma.end / getpagesize();
+    return ReadPageRangeStats(pagemap_fd, first_page, last_page, get_wss, use_pageidle,
+                              update_mem_usage, update_swap_usage, &vma.usage, &swap_slots_,
+                              SessionPageCache());
+}
 
-    std::vector<uint64_t> page_cache;
-    size_t cur_page_cache_index = 0;
-    size_t num_in_page_cache = 0;
-    size_t num_leftover_pages = num_pages;
-    for (size_t cur_page = first_page; cur_page < first_page + num_pages; ++cur_page) {
-        // Cache page map data.
-        if (cur_page_cache_index == num_in_page_cache) {
-            static constexpr size_t kMaxPages = 2048;
-            num_leftover_pages -= num_in_page_cache;
-            if (num_leftover_pages > kMaxPages) {
-                num_in_page_cache = kMaxPages;
-            } else {
-                num_in_page_cache = num_leftover_pages;
+bool ProcMemInfo::ReadPageRangeStats(int pagemap_fd, size_t first_page, size_t last_page,
+                                     bool get_wss, bool use_pageidle, bool update_mem_usage,
+                                     bool update_swap_usage, MemUsage* usage,
+                                     std::vector<uint64_t>* swap_slots,
+                                     std::vector<uint64_t>* page_cache) const {
+    PageAcct& pinfo = PageAcct::Instance();
+    uint64_t pagesz_kb = getpagesize() / 1024;
+
+    // Page frames of all present pages in the range. Their flags and map counts are
+    // resolved once the whole range has been walked, so PageAcct can sort them and
+    // turn the lookups into a few sequential reads.
+    std::vector<uint64_t> page_frames;
+
+    // A transparent huge page mapped by a PMD shows up as one page table worth of page map
+    // entries, starting at an aligned virtual page, that point to as many contiguous page
+    // frames starting at an aligned frame. The first frame of such runs goes to 'thp_frames'
+    // instead, and if it turns out to be the head of a THP, the whole run is accounted with
+    // the flags and map count of the head alone. Runs can't be told apart when filtering on
+    // the compound page flags, which differ between the head and the tail pages.
+    const size_t thp_pages = getpagesize() / sizeof(uint64_t);
+    const bool find_thps =
+            (pgflags_mask_ & ((1 << KPF_COMPOUND_HEAD) | (1 << KPF_COMPOUND_TAIL))) == 0;
+    std::vector<uint64_t> thp_frames;
+    size_t run_page = 0;
+    uint64_t run_pfn = 0;
+    size_t run_len = 0;
+    auto flush_run = [&]() {
+        for (size_t i = 0; i < run_len; i++) {
+            page_frames.emplace_back(run_pfn + i);
+        }
+        run_len = 0;
+    };
+
+    // Each chunk is sorted into present and swapped out pages at once, see ClassifyPageMap(),
+    // so stretches of absent pages are skipped 64 at a time.
+    std::vector<uint64_t> present_mask;
+    std::vector<uint64_t> swapped_mask;
+    std::vector<uint64_t> present_pfns;
+    auto account_chunk = [&](size_t chunk_page, std::span<const uint64_t> entries) {
+        size_t nr_words = (entries.size() + 63) / 64;
+        if (present_pfns.size() < entries.size()) {
+            present_mask.resize(nr_words);
+            swapped_mask.resize(nr_words);
+            present_pfns.resize(entries.size());
+        }
+        size_t nr_present, nr_swapped;
+        if (!ClassifyPageMap(entries, present_mask, swapped_mask, present_pfns, &nr_present,
+                             &nr_swapped)) {
+            return false;
+        }
+
+        if (update_swap_usage) {
+            usage->swap += pagesz_kb * nr_swapped;
+        }
+        for (size_t w = 0; nr_swapped > 0 && w < nr_words; w++) {
+            for (uint64_t bits = swapped_mask[w]; bits; bits &= bits - 1) {
+                uint64_t page_info = entries[w * 64 + __builtin_ctzll(bits)];
+                swap_slots->emplace_back(SwapSlotList::Slot(PAGE_SWAP_TYPE(page_info),
+                                                            PAGE_SWAP_OFFSET(page_info)));
             }
-            page_cache.resize(num_in_page_cache);
-            size_t total_bytes = page_cache.size() * sizeof(uint64_t);
-            ssize_t bytes = pread64(pagemap_fd, page_cache.data(), total_bytes,
-                                    cur_page * sizeof(uint64_t));
-            if (bytes != total_bytes) {
-                if (bytes == -1) {
-                    PLOG(ERROR) << "Failed to read page data at offset 0x" << std::hex
-                                << cur_page * sizeof(uint64_t);
+        }
+
+        if (!update_mem_usage || nr_present == 0) return true;
+
+        if (!find_thps) {
+            page_frames.insert(page_frames.end(), present_pfns.begin(),
+                               present_pfns.begin() + nr_present);
+            return true;
+        }
+
+        size_t next_pfn = 0;
+        for (size_t w = 0; w < nr_words; w++) {
+            for (uint64_t bits = present_mask[w]; bits; bits &= bits - 1) {
+                size_t page = chunk_page + w * 64 + __builtin_ctzll(bits);
+                uint64_t pfn = present_pfns[next_pfn++];
+                if (run_len > 0 && page == run_page + run_len && pfn == run_pfn + run_len) {
+                    if (++run_len == thp_pages) {
+                        thp_frames.emplace_back(run_pfn);
+                        run_len = 0;
+                    }
+                    continue;
+                }
+
+                flush_run();
+                if (page % thp_pages == 0 && pfn % thp_pages == 0) {
+                    run_page = page;
+                    run_pfn = pfn;
+                    run_len = 1;
                 } else {
-                    LOG(ERROR) << "Failed to read page data at offset 0x" << std::hex
-                               << cur_page * sizeof(uint64_t) << std::dec << " read bytes " << bytes
-                               << " expected bytes " << total_bytes;
+                    page_frames.emplace_back(pfn);
                 }
-                return false;
             }
-            cur_page_cache_index = 0;
         }
+        return true;
+    };
 
-        uint64_t page_info = page_cache[cur_page_cache_index++];
-        if (!PAGE_PRESENT(page_info) && !PAGE_SWAPPED(page_info)) continue;
-
-        if (PAGE_SWAPPED(page_info)) {
-            if (update_swap_usage) {
-                vma.usage.swap += pagesz_kb;
+    // Only present and swapped out pages are accounted.
+    uint64_t categories = PAGE_IS_SWAPPED | (update_mem_usage ? PAGE_IS_PRESENT : 0);
+    if (!ForEachPageMapEntryChunk(pagemap_fd, first_page, last_page, categories, page_cache,
+                                  SessionMaxPages(), account_chunk)) {
+        return false;
+    }
+    flush_run();
+
+    // Runs whose first frame isn't the head of a THP are accounted page by page.
+    std::vector<uint64_t> thp_flags(thp_frames.size());
+    if (!thp_frames.empty() && !pinfo.PageFlagsBatch(thp_frames, thp_flags)) {
+        LOG(ERROR) << "Failed to get page flags for pages " << std::hex
+                   << first_page * getpagesize() << "-" << last_page * getpagesize() << std::dec
+                   << " in process " << pid_;
+        swap_slots->clear();
+        return false;
+    }
+    size_t num_thps = 0;
+    for (size_t i = 0; i < thp_frames.size(); i++) {
+        if (!KPAGEFLAG_THP(thp_flags[i]) || !(thp_flags[i] & (1 << KPF_COMPOUND_HEAD))) {
+            for (size_t j = 0; j < thp_pages; j++) {
+                page_frames.emplace_back(thp_frames[i] + j);
             }
-            swap_offsets_.emplace_back(PAGE_SWAP_OFFSET(page_info));
             continue;
         }
+        thp_frames[num_thps] = thp_frames[i];
+        thp_flags[num_thps] = thp_flags[i];
+        num_thps++;
+    }
 
-        if (!update_mem_usage) continue;
-
-        uint64_t page_frame = PAGE_PFN(page_info);
-        uint64_t cur_page_flags;
-        if (!pinfo.PageFlags(page_frame, &cur_page_flags)) {
-            LOG(ERROR) << "Failed to get page flags for " << page_frame << " in process " << pid_;
-            swap_offsets_.clear();
+    if (!page_frames.empty() || num_thps > 0) {
+        std::vector<uint64_t> page_flags(page_frames.size());
+        if (!page_frames.empty() && !pinfo.PageFlagsBatch(page_frames, page_flags)) {
+            LOG(ERROR) << "Failed to get page flags for pages " << std::hex
+                       << first_page * getpagesize() << "-" << last_page * getpagesize()
+                       << std::dec << " in process " << pid_;
+            swap_slots->clear();
             return false;
         }
 
-        if (KPAGEFLAG_THP(cur_page_flags)) {
-            vma.usage.thp += pagesz_kb;
-        }
+        // THP heads go last, each of them stands for 'thp_pages' pages.
+        size_t num_pages = page_frames.size();
+        page_frames.insert(page_frames.end(), thp_frames.begin(), thp_frames.begin() + num_thps);
+        page_flags.insert(page_flags.end(), thp_flags.begin(), thp_flags.begin() + num_thps);
+
+        // skip unwanted pages from the count, so their map counts aren't read
+        size_t num_wanted = 0;
+        size_t num_wanted_pages = 0;
+        for (size_t i = 0; i < page_frames.size(); i++) {
+            uint64_t nr_pages = i < num_pages ? 1 : thp_pages;
+            if (KPAGEFLAG_THP(page_flags[i])) {
+                usage->thp += nr_pages * pagesz_kb;
+            }
 
-        // skip unwanted pages from the count
-        if ((cur_page_flags & pgflags_mask_) != pgflags_) continue;
+            if ((page_flags[i] & pgflags_mask_) != pgflags_) continue;
 
-        uint64_t cur_page_counts;
-        if (!pinfo.PageMapCount(page_frame, &cur_page_counts)) {
-            LOG(ERROR) << "Failed to get page count for " << page_frame << " in process " << pid_;
-            swap_offsets_.clear();
+            page_frames[num_wanted] = page_frames[i];
+            page_flags[num_wanted] = page_flags[i];
+            num_wanted++;
+            num_wanted_pages += i < num_pages;
+        }
+        page_frames.resize(num_wanted);
+        page_flags.resize(num_wanted);
+
+        std::vector<uint64_t> page_counts(num_wanted);
+        if (!pinfo.PageMapCountBatch(page_frames, page_counts)) {
+            LOG(ERROR) << "Failed to get page counts for pages " << std::hex
+                       << first_page * getpagesize() << "-" << last_page * getpagesize()
+                       << std::dec << " in process " << pid_;
+            swap_slots->clear();
             return false;
         }
 
-        // Page was unmapped between the presence check at the beginning of the loop and here.
-        if (cur_page_counts == 0) {
-            continue;
+        // Idle page tracking marks and then checks every page, do both for the whole
+        // range at once. The idle flag of a THP is kept in its head, so the heads are enough.
+        std::vector<uint8_t> page_idle;
+        if (get_wss && use_pageidle) {
+            page_idle.resize(num_wanted);
+            if (!pinfo.MarkPagesIdle(page_frames) || !pinfo.GetPagesIdle(page_frames, page_idle)) {
+                LOG(ERROR) << "Failed to get idle state for pages " << std::hex
+                           << first_page * getpagesize() << "-" << last_page * getpagesize()
+                           << std::dec << " in process " << pid_;
+                swap_slots->clear();
+                return false;
+            }
         }
 
-        bool is_dirty = !!(cur_page_flags & (1 << KPF_DIRTY));
-        bool is_private = (cur_page_counts == 1);
-        // Working set
-        if (get_wss) {
-            bool is_referenced = use_pageidle ? (pinfo.IsPageIdle(page_frame) == 1)
-                                              : !!(cur_page_flags & (1 << KPF_REFERENCED));
-            if (!is_referenced) {
+        for (size_t i = 0; i < num_wanted; i++) {
+            uint64_t cur_page_flags = page_flags[i];
+            uint64_t cur_page_counts = page_counts[i];
+            uint64_t nr_pages = i < num_wanted_pages ? 1 : thp_pages;
+            uint64_t size_kb = nr_pages * pagesz_kb;
+
+            // Page was unmapped between reading the page map and its count.
+            if (cur_page_counts == 0) {
                 continue;
             }
-            // This effectively makes vss = rss for the working set is requested.
-            // The libpagemap implementation returns vss > rss for
-            // working set, which doesn't make sense.
-            vma.usage.vss += pagesz_kb;
-        }
 
-        vma.usage.rss += pagesz_kb;
-        vma.usage.uss += is_private ? pagesz_kb : 0;
-        vma.usage.pss += pagesz_kb / cur_page_counts;
-        if (is_private) {
-            vma.usage.private_dirty += is_dirty ? pagesz_kb : 0;
-            vma.usage.private_clean += is_dirty ? 0 : pagesz_kb;
-        } else {
-            vma.usage.shared_dirty += is_dirty ? pagesz_kb : 0;
-            vma.usage.shared_clean += is_dirty ? 0 : pagesz_kb;
+            bool is_dirty = !!(cur_page_flags & (1 << KPF_DIRTY));
+            bool is_private = (cur_page_counts == 1);
+            // Working set
+            if (get_wss) {
+                bool is_referenced = use_pageidle ? !!page_idle[i]
+                                                  : !!(cur_page_flags & (1 << KPF_REFERENCED));
+                if (!is_referenced) {
+                    continue;
+                }
+                // This effectively makes vss = rss for the working set is requested.
+                // The libpagemap implementation returns vss > rss for
+                // working set, which doesn't make sense.
+                usage->vss += size_kb;
+            }
+
+            usage->rss += size_kb;
+            usage->uss += is_private ? size_kb : 0;
+            usage->pss += nr_pages * (pagesz_kb / cur_page_counts);
+            if (is_private) {
+                usage->private_dirty += is_dirty ? size_kb : 0;
+                usage->private_clean += is_dirty ? 0 : size_kb;
+            } else {
+                usage->shared_dirty += is_dirty ? size_kb : 0;
+                usage->shared_clean += is_dirty ? 0 : size_kb;
+            }
         }
     }
     if (!get_wss) {
-        vma.usage.vss += pagesz_kb * num_pages;
+        usage->vss += pagesz_kb * (last_page - first_page);
     }
     return true;
 }
 
+bool ParseSmapsVmaHeader(std::string_view line, VmaView* vma, size_t* name_offset,
+                         size_t* name_len) {
+    const char* begin = line.data();
+    const char* end = begin + line.size();
+    const char* p = begin;
+    const char* q;
+
+    // start-end
+    q = ParseProcNumber<16>(p, end, &vma->start);
+    if (q == p || q == end || *q != '-') return false;
+    p = q + 1;
+    q = ParseProcNumber<16>(p, end, &vma->end);
+    if (q == p || q == end || *q != ' ') return false;
+    p = q + 1;
+
+    // perms
+    if (end - p < 5 || p[4] != ' ') return false;
+    vma->flags = 0;
+    if (p[0] == 'r') vma->flags |= PROT_READ;
+    if (p[1] == 'w') vma->flags |= PROT_WRITE;
+    if (p[2] == 'x') vma->flags |= PROT_EXEC;
+    vma->is_shared = p[3] == 's';
+    p += 5;
+
+    // offset
+    q = ParseProcNumber<16>(p, end, &vma->offset);
+    if (q == p || q == end || *q != ' ') return false;
+    p = q + 1;
+
+    // dev, major:minor
+    uint64_t dev;
+    q = ParseProcNumber<16>(p, end, &dev);
+    if (q == p || q == end || *q != ':') return false;
+    p = q + 1;
+    q = ParseProcNumber<16>(p, end, &dev);
+    if (q == p || q == end || *q != ' ') return false;
+    p = q + 1;
+
+    // inode
+    q = ParseProcNumber<10>(p, end, &vma->inode);
+    if (q == p || (q != end && !IsProcBlank(*q))) return false;
+    p = q;
+
+    // name, the rest of the line
+    while (p < end && IsProcBlank(*p)) p++;
+    *name_offset = p - begin;
+    *name_len = end - p;
+    return true;
+}
+
 // Public APIs
 bool ForEachVmaFromFile(const std::string& path, const VmaCallback& callback,
                         bool read_smaps_fields) {
-    auto fp = std::unique_ptr<FILE, decltype(&fclose)>{fopen(path.c_str(), "re"), fclose};
-    if (fp == nullptr) {
-        return false;
-    }
-
-    char* line = nullptr;
-    bool parsing_vma = false;
-    ssize_t line_len;
-    size_t line_alloc = 0;
-    Vma vma;
-    while ((line_len = getline(&line, &line_alloc, fp.get())) > 0) {
-        // Make sure the line buffer terminates like a C string for ReadMapFile
-        line[line_len] = '\0';
-
-        if (parsing_vma) {
-            if (parse_smaps_field(line, &vma.usage)) {
-                // This was a stats field
-                continue;
-            }
-
-            // Done collecting stats, make the call back
-            if (!callback(vma)) {
-                free(line);
-                return false;
-            }
-            parsing_vma = false;
-        }
-
-        vma.clear();
-        // If it has, we are looking for the vma stats
-        // 00400000-00409000 r-xp 00000000 fc:00 426998  /usr/lib/gvfs/gvfsd-http
-        if (!::android::procinfo::ReadMapFileContent(
-                    line, [&](const android::procinfo::MapInfo& mapinfo) {
-                        vma.start = mapinfo.start;
-                        vma.end = mapinfo.end;
-                        vma.flags = mapinfo.flags;
-                        vma.offset = mapinfo.pgoff;
-                        vma.name = mapinfo.name;
-                        vma.inode = mapinfo.inode;
-                        vma.is_shared = mapinfo.shared;
-                    })) {
-            // free getline() managed buffer
-            free(line);
-            LOG(ERROR) << "Failed to parse " << path;
-            return false;
-        }
-        if (read_smaps_fields) {
-            parsing_vma = true;
-        } else {
-            // Done collecting stats, make the call back
-            if (!callback(vma)) {
-                free(line);
-                return false;
-            }
-        }
-    }
-
-    // free getline() managed buffer
-    free(line);
+    return ForEachVmaFromFile<const VmaCallback&>(path, callback, read_smaps_fields);
+}
 
-    if (parsing_vma) {
-        if (!callback(vma)) {
-            return false;
-        }
-    }
+bool ForEachVmaFromFile(const std::string& path, const VmaCallback& callback,
+                        bool read_smaps_fields, ParseContext& ctx) {
+    return ForEachVmaFromFile<const VmaCallback&>(path, callback, read_smaps_fields, ctx);
+}
 
-    return true;
+bool ForEachVmaViewFromFile(const std::string& path, VmaViewCallback callback,
+                            bool read_smaps_fields, std::string* buffer) {
+    return ForEachSmapsVma<kSmapsAllFields>(path, callback, read_smaps_fields, buffer);
 }
 
 enum smaps_rollup_support { UNTRIED, SUPPORTED, UNSUPPORTED };
@@ -677,98 +1269,37 @@ bool IsSmapsRollupSupported() {
 }
 
 bool SmapsOrRollupFromFile(const std::string& path, MemUsage* stats) {
-    auto fp = std::unique_ptr<FILE, decltype(&fclose)>{fopen(path.c_str(), "re"), fclose};
-    if (fp == nullptr) {
-        return false;
-    }
+    return ParseSmaps<kSmapsOrRollupFields>(path, stats);
+}
 
-    char* line = nullptr;
-    size_t line_alloc = 0;
-    stats->clear();
-    while (getline(&line, &line_alloc, fp.get()) > 0) {
-        switch (line[0]) {
-            case 'P':
-                if (strncmp(line, "Pss:", 4) == 0) {
-                    char* c = line + 4;
-                    stats->pss += strtoull(c, nullptr, 10);
-                } else if (strncmp(line, "Private_Clean:", 14) == 0) {
-                    char* c = line + 14;
-                    uint64_t prcl = strtoull(c, nullptr, 10);
-                    stats->private_clean += prcl;
-                    stats->uss += prcl;
-                } else if (strncmp(line, "Private_Dirty:", 14) == 0) {
-                    char* c = line + 14;
-                    uint64_t prdi = strtoull(c, nullptr, 10);
-                    stats->private_dirty += prdi;
-                    stats->uss += prdi;
-                }
-                break;
-            case 'R':
-                if (strncmp(line, "Rss:", 4) == 0) {
-                    char* c = line + 4;
-                    stats->rss += strtoull(c, nullptr, 10);
-                }
-                break;
-            case 'S':
-                if (strncmp(line, "SwapPss:", 8) == 0) {
-                    char* c = line + 8;
-                    stats->swap_pss += strtoull(c, nullptr, 10);
-                }
-                break;
-        }
-    }
+bool SmapsOrRollupFromFile(const std::string& path, MemUsage* stats, ParseContext& ctx) {
+    return ParseSmaps<kSmapsOrRollupFields>(path, stats, &ctx.buffer);
+}
 
-    // free getline() managed buffer
-    free(line);
+static bool SmapsOrRollupPssFromFile(const std::string& path, uint64_t* pss, std::string* buffer) {
+    MemUsage stats;
+    if (!ParseSmaps<kSmapsPss>(path, &stats, buffer)) {
+        return false;
+    }
+    *pss = stats.pss;
     return true;
 }
 
 bool SmapsOrRollupPssFromFile(const std::string& path, uint64_t* pss) {
-    auto fp = std::unique_ptr<FILE, decltype(&fclose)>{fopen(path.c_str(), "re"), fclose};
-    if (fp == nullptr) {
-        return false;
-    }
-    *pss = 0;
-    char* line = nullptr;
-    size_t line_alloc = 0;
-    while (getline(&line, &line_alloc, fp.get()) > 0) {
-        uint64_t v;
-        if (sscanf(line, "Pss: %" SCNu64 " kB", &v) == 1) {
-            *pss += v;
-        }
-    }
+    return SmapsOrRollupPssFromFile(path, pss, nullptr);
+}
 
-    // free getline() managed buffer
-    free(line);
-    return true;
+bool SmapsOrRollupPssFromFile(const std::string& path, uint64_t* pss, ParseContext& ctx) {
+    return SmapsOrRollupPssFromFile(path, pss, &ctx.buffer);
 }
 
 bool StatusVmRSSFromFile(const std::string& path, uint64_t* rss) {
-    auto fp = std::unique_ptr<FILE, decltype(&fclose)>{fopen(path.c_str(), "re"), fclose};
-    if (fp == nullptr) {
+    ProcStatus status;
+    if (!ProcStatusFromFile(path, kStatusVmRSS, &status)) {
         return false;
     }
-
-    // We use this bool because -1 as an "invalid" value for RSS will wrap
-    // around to a positive number.
-    bool success = false;
-
-    *rss = 0;
-    char* line = nullptr;
-    size_t line_alloc = 0;
-    while (getline(&line, &line_alloc, fp.get()) > 0) {
-        uint64_t v;
-        if (sscanf(line, "VmRSS: %" SCNu64 " kB", &v) == 1) {
-            *rss = v;
-            success = true;
-            // Break because there is only one VmRSS field in status.
-            break;
-        }
-    }
-
-    // free getline() managed buffer
-    free(line);
-    return success;
+    *rss = status.vm_rss;
+    return (status.fields & kStatusVmRSS) != 0;
 }
 
 Format GetFormat(std::string_view arg) {
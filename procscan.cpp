@@ -0,0 +1,104 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__aarch64__)
+#include <arm_neon.h>
+#endif
+
+#include "procscan.h"
+
+namespace android {
+namespace meminfo {
+
+#if !defined(__SSE2__) && defined(__aarch64__)
+// Bit i of the result is set if byte i of 'eq', a vceqq_u8() result, is.
+static inline uint16_t MoveMask(uint8x16_t eq) {
+    static const uint8x16_t kBits = {1, 2, 4, 8, 16, 32, 64, 128, 1, 2, 4, 8, 16, 32, 64, 128};
+    uint8x16_t bits = vandq_u8(eq, kBits);
+    return vaddv_u8(vget_low_u8(bits)) | (vaddv_u8(vget_high_u8(bits)) << 8);
+}
+#endif
+
+uint64_t ScanNewlines(const char* p, size_t n) {
+    uint64_t mask = 0;
+    size_t i = 0;
+#if defined(__AVX2__)
+    const __m256i nl = _mm256_set1_epi8('\n');
+    for (; i + 32 <= n; i += 32) {
+        __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p + i));
+        uint64_t m = static_cast<uint32_t>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, nl)));
+        mask |= m << i;
+    }
+#elif defined(__SSE2__)
+    const __m128i nl = _mm_set1_epi8('\n');
+    for (; i + 16 <= n; i += 16) {
+        __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + i));
+        uint64_t m = static_cast<uint32_t>(_mm_movemask_epi8(_mm_cmpeq_epi8(v, nl)));
+        mask |= m << i;
+    }
+#elif defined(__aarch64__)
+    const uint8x16_t nl = vdupq_n_u8('\n');
+    for (; i + 16 <= n; i += 16) {
+        uint8x16_t v = vld1q_u8(reinterpret_cast<const uint8_t*>(p + i));
+        mask |= static_cast<uint64_t>(MoveMask(vceqq_u8(v, nl))) << i;
+    }
+#endif
+    for (; i < n; i++) {
+        mask |= static_cast<uint64_t>(p[i] == '\n') << i;
+    }
+    return mask;
+}
+
+size_t FindBlank(const char* p, size_t n) {
+    size_t i = 0;
+#if defined(__AVX2__) || defined(__SSE2__)
+    const __m128i space = _mm_set1_epi8(' ');
+    const __m128i tab = _mm_set1_epi8('\t');
+    for (; i + 16 <= n; i += 16) {
+        __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + i));
+        int m = _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(v, space), _mm_cmpeq_epi8(v, tab)));
+        if (m != 0) {
+            return i + __builtin_ctz(m);
+        }
+    }
+#elif defined(__aarch64__)
+    const uint8x16_t space = vdupq_n_u8(' ');
+    const uint8x16_t tab = vdupq_n_u8('\t');
+    for (; i + 16 <= n; i += 16) {
+        uint8x16_t v = vld1q_u8(reinterpret_cast<const uint8_t*>(p + i));
+        uint16_t m = MoveMask(vorrq_u8(vceqq_u8(v, space), vceqq_u8(v, tab)));
+        if (m != 0) {
+            return i + __builtin_ctz(m);
+        }
+    }
+#endif
+    for (; i < n; i++) {
+        if (p[i] == ' ' || p[i] == '\t') {
+            return i;
+        }
+    }
+    return n;
+}
+
+}  // namespace meminfo
+}  // namespace android
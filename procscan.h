@@ -0,0 +1,190 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <string>
+#include <string_view>
+
+// Internal scanning of /proc text files: finding lines and the fields in them a block of bytes
+// at a time instead of byte by byte.
+
+namespace android {
+namespace meminfo {
+
+// Returns a mask with bit i set if p[i] is a newline, for the first 'n' <= 64 bytes of 'p'.
+uint64_t ScanNewlines(const char* p, size_t n);
+
+// Returns the index of the first space or tab in the 'n' bytes at 'p', or 'n' if there is none.
+size_t FindBlank(const char* p, size_t n);
+
+inline bool IsProcBlank(char c) {
+    return c == ' ' || c == '\t';
+}
+
+// Hand-rolled strtoull() for the numbers in /proc files. Reads the number starting at 'p',
+// stops at 'end' or at the first character that isn't a digit of 'Base' and returns the position
+// after the number.
+template <int Base>
+inline const char* ParseProcNumber(const char* p, const char* end, uint64_t* value) {
+    uint64_t v = 0;
+    for (; p < end; p++) {
+        unsigned digit;
+        if (*p >= '0' && *p <= '9') {
+            digit = *p - '0';
+        } else if (Base == 16 && (*p | 0x20) >= 'a' && (*p | 0x20) <= 'f') {
+            digit = (*p | 0x20) - 'a' + 10;
+        } else {
+            break;
+        }
+        v = v * Base + digit;
+    }
+    *value = v;
+    return p;
+}
+
+// Iterates over the lines of a block of text, finding newlines 64 bytes at a time.
+class LineScanner final {
+  public:
+    // If 'complete', a last line without a newline is returned too, otherwise it is left in
+    // remaining().
+    explicit LineScanner(std::string_view text = {}, bool complete = true)
+        : line_(text.data()), block_(text.data()), end_(text.data() + text.size()),
+          complete_(complete) {}
+
+    // Sets 'line' to the next line, without its newline. Returns false if there is none.
+    bool Next(std::string_view* line) {
+        while (mask_ == 0) {
+            size_t n = std::min<size_t>(64, end_ - block_);
+            if (n == 0) {
+                if (!complete_ || line_ == end_) {
+                    return false;
+                }
+                *line = std::string_view(line_, end_ - line_);
+                line_ = end_;
+                return true;
+            }
+            mask_ = ScanNewlines(block_, n);
+            mask_base_ = block_;
+            block_ += n;
+        }
+        const char* nl = mask_base_ + __builtin_ctzll(mask_);
+        mask_ &= mask_ - 1;
+        *line = std::string_view(line_, nl - line_);
+        line_ = nl + 1;
+        return true;
+    }
+
+    // The text after the last line returned.
+    std::string_view remaining() const { return std::string_view(line_, end_ - line_); }
+
+  private:
+    // Start of the next line.
+    const char* line_;
+    // Newlines before 'block_' have been scanned, those still to be returned are in 'mask_',
+    // relative to 'mask_base_'.
+    const char* block_;
+    const char* end_;
+    const char* mask_base_ = nullptr;
+    uint64_t mask_ = 0;
+    bool complete_;
+};
+
+// Reads a /proc text file line by line, with large reads into a buffer that can be reused
+// across files.
+class ProcFileLineReader final {
+  public:
+    // Reads 'fd' into 'buffer', or a buffer of its own if null.
+    ProcFileLineReader(int fd, std::string* buffer)
+        : fd_(fd), buf_(buffer ? *buffer : local_buf_) {
+        if (buf_.size() < kReadSize) {
+            buf_.resize(kReadSize);
+        }
+        lines_ = LineScanner(std::string_view(buf_.data(), 0), false);
+    }
+
+    // Sets 'line' to the next line, without its newline. Returns false at the end of the file
+    // or if reading failed, see error().
+    bool Next(std::string_view* line) {
+        while (!lines_.Next(line)) {
+            if (eof_ || !Fill()) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    bool error() const { return error_; }
+
+    // Positions in the file of bytes in the buffer, which stay valid as the buffer moves.
+    uint64_t Position(const char* p) const { return base_ + (p - buf_.data()); }
+    const char* At(uint64_t position) const { return buf_.data() + (position - base_); }
+
+    // Keeps the bytes from 'position' on, which must still be in the buffer, in the buffer
+    // until the next call. kKeepNone lets the buffer move past the current line.
+    static constexpr uint64_t kKeepNone = UINT64_MAX;
+    void Keep(uint64_t position) { keep_ = position; }
+
+  private:
+    // Large enough for most smaps files to be read in a few calls.
+    static constexpr size_t kReadSize = 64 * 1024;
+
+    bool Fill() {
+        // Move the partial line, and anything kept, to the front and grow the buffer if that
+        // doesn't leave room to read into.
+        size_t begin = lines_.remaining().data() - buf_.data();
+        size_t from = keep_ == kKeepNone ? begin : std::min<size_t>(keep_ - base_, begin);
+        if (from > 0) {
+            memmove(buf_.data(), buf_.data() + from, end_ - from);
+            begin -= from;
+            end_ -= from;
+            base_ += from;
+        }
+        if (end_ == buf_.size()) {
+            buf_.resize(buf_.size() * 2);
+        }
+
+        ssize_t bytes = TEMP_FAILURE_RETRY(read(fd_, buf_.data() + end_, buf_.size() - end_));
+        if (bytes < 0) {
+            error_ = true;
+            return false;
+        }
+        eof_ = bytes == 0;
+        end_ += bytes;
+        lines_ = LineScanner(std::string_view(buf_.data() + begin, end_ - begin), eof_);
+        return true;
+    }
+
+    int fd_;
+    std::string local_buf_;
+    std::string& buf_;
+    // The bytes read are buf_[0, end_), and buf_[0] is at base_ in the file.
+    LineScanner lines_;
+    size_t end_ = 0;
+    uint64_t base_ = 0;
+    uint64_t keep_ = kKeepNone;
+    bool eof_ = false;
+    bool error_ = false;
+};
+
+}  // namespace meminfo
+}  // namespace android
@@ -0,0 +1,136 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <iterator>
+#include <string>
+#include <string_view>
+
+#include <android-base/unique_fd.h>
+
+#include <meminfo/procstatus.h>
+
+#include "procscan.h"
+
+namespace android {
+namespace meminfo {
+
+// The key and member of each field, by bit number.
+struct ProcStatusKey {
+    std::string_view key;
+    uint64_t ProcStatus::*member;
+};
+
+static constexpr ProcStatusKey kProcStatusKeys[] = {
+        {"VmPeak", &ProcStatus::vm_peak},
+        {"VmSize", &ProcStatus::vm_size},
+        {"VmLck", &ProcStatus::vm_lck},
+        {"VmHWM", &ProcStatus::vm_hwm},
+        {"VmRSS", &ProcStatus::vm_rss},
+        {"RssAnon", &ProcStatus::rss_anon},
+        {"RssFile", &ProcStatus::rss_file},
+        {"RssShmem", &ProcStatus::rss_shmem},
+        {"VmSwap", &ProcStatus::vm_swap},
+        {"Threads", &ProcStatus::threads},
+};
+
+static_assert(kStatusAllFields == (1u << std::size(kProcStatusKeys)) - 1);
+
+// status is read in a single read unless a line, e.g. Groups:, is unusually long.
+static constexpr size_t kProcStatusBufferSize = 4096;
+
+// Parses 'line' if it is one of 'fields', and returns its bit, or 0 if it isn't.
+static uint32_t ParseProcStatusLine(std::string_view line, uint32_t fields, ProcStatus* status) {
+    size_t colon = line.find(':');
+    if (colon == std::string_view::npos) {
+        return 0;
+    }
+    std::string_view key = line.substr(0, colon);
+    for (; fields != 0; fields &= fields - 1) {
+        int bit = __builtin_ctz(fields);
+        if (kProcStatusKeys[bit].key != key) {
+            continue;
+        }
+        const char* p = line.data() + colon + 1;
+        const char* end = line.data() + line.size();
+        while (p < end && IsProcBlank(*p)) p++;
+        uint64_t value;
+        if (ParseProcNumber<10>(p, end, &value) == p) {
+            return 0;
+        }
+        status->*kProcStatusKeys[bit].member = value;
+        return 1u << bit;
+    }
+    return 0;
+}
+
+bool ReadProcStatus(int fd, uint32_t fields, ProcStatus* status) {
+    *status = {};
+    fields &= kStatusAllFields;
+
+    char buf[kProcStatusBufferSize];
+    uint64_t offset = 0;
+    // buf[0, len) is the start of a line that didn't fit in the last read.
+    size_t len = 0;
+    // The rest of a line longer than the buffer is dropped.
+    bool skip_line = false;
+    while (status->fields != fields) {
+        ssize_t bytes = TEMP_FAILURE_RETRY(pread(fd, buf + len, sizeof(buf) - len, offset));
+        if (bytes < 0) {
+            return false;
+        }
+        offset += bytes;
+        len += bytes;
+        bool eof = bytes == 0;
+
+        LineScanner lines(std::string_view(buf, len), eof);
+        std::string_view line;
+        while (status->fields != fields && lines.Next(&line)) {
+            if (skip_line) {
+                skip_line = false;
+                continue;
+            }
+            status->fields |= ParseProcStatusLine(line, fields & ~status->fields, status);
+        }
+        if (eof || status->fields == fields) {
+            break;
+        }
+
+        std::string_view rest = lines.remaining();
+        if (rest.size() == sizeof(buf)) {
+            skip_line = true;
+            len = 0;
+        } else {
+            memmove(buf, rest.data(), rest.size());
+            len = rest.size();
+        }
+    }
+    return true;
+}
+
+bool ProcStatusFromFile(const std::string& path, uint32_t fields, ProcStatus* status) {
+    ::android::base::unique_fd fd(TEMP_FAILURE_RETRY(open(path.c_str(), O_RDONLY | O_CLOEXEC)));
+    if (fd == -1) {
+        return false;
+    }
+    return ReadProcStatus(fd, fields, status);
+}
+
+}  // namespace meminfo
+}  // namespace android
@@ -0,0 +1,128 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <unistd.h>
+
+#include <string>
+#include <string_view>
+
+#include <android-base/logging.h>
+#include <android-base/unique_fd.h>
+
+#include "meminfo_private.h"
+#include "smapsparser.h"
+
+namespace android {
+namespace meminfo {
+
+// smaps_rollup is well under a page, this fits the smaps of most processes as well.
+static constexpr size_t kInitialBufferSize = 16 * 1024;
+
+static int OpenRollup(pid_t pid, bool rollup) {
+    char path[64];
+    snprintf(path, sizeof(path), "/proc/%d/%s", pid, rollup ? "smaps_rollup" : "smaps");
+    return TEMP_FAILURE_RETRY(open(path, O_RDONLY | O_CLOEXEC));
+}
+
+// Reads all of the file open at 'fd' into 'buffer' and returns its size, or -1 on failure.
+// Fails with ESRCH if the mm the file was opened for is gone.
+static ssize_t ReadRollup(int fd, bool rollup, std::string* buffer) {
+    if (buffer->size() < kInitialBufferSize) {
+        buffer->resize(kInitialBufferSize);
+    }
+    size_t size = 0;
+    while (true) {
+        if (size == buffer->size()) {
+            buffer->resize(buffer->size() * 2);
+        }
+        size_t space = buffer->size() - size;
+        ssize_t bytes = TEMP_FAILURE_RETRY(pread(fd, buffer->data() + size, space, size));
+        if (bytes < 0) {
+            return -1;
+        }
+        size += bytes;
+        // smaps_rollup is a single record, which a short read returns all of. smaps is read
+        // up to a record that doesn't fit, until the end of the file.
+        if (bytes == 0 || (rollup && static_cast<size_t>(bytes) < space)) {
+            break;
+        }
+    }
+
+    // smaps, unlike smaps_rollup, reads as empty instead of failing once the mm is gone.
+    if (size == 0) {
+        errno = ESRCH;
+        return -1;
+    }
+    return size;
+}
+
+ssize_t RollupReader::Read(pid_t pid) {
+    bool rollup = IsSmapsRollupSupported();
+    auto it = files_.find(pid);
+    bool reopened = false;
+    if (it == files_.end()) {
+        ::android::base::unique_fd fd(OpenRollup(pid, rollup));
+        if (fd == -1) {
+            return -1;
+        }
+        it = files_.emplace(pid, std::move(fd)).first;
+        reopened = true;
+    }
+
+    ssize_t size = ReadRollup(it->second, rollup, &buffer_);
+    // The file is bound to the mm it was opened with, which the process drops when it execs.
+    // Open the file again before reporting a process that is still running as gone.
+    if (size < 0 && errno == ESRCH && !reopened) {
+        it->second.reset(OpenRollup(pid, rollup));
+        if (it->second != -1) {
+            size = ReadRollup(it->second, rollup, &buffer_);
+        } else {
+            errno = ESRCH;
+        }
+    }
+    if (size < 0) {
+        int saved_errno = errno;
+        files_.erase(it);
+        errno = saved_errno;
+    }
+    return size;
+}
+
+bool RollupReader::SmapsOrRollup(pid_t pid, MemUsage* stats) {
+    ssize_t size = Read(pid);
+    if (size < 0) {
+        return false;
+    }
+    ParseSmapsText<kSmapsOrRollupFields>(std::string_view(buffer_.data(), size), stats);
+    return true;
+}
+
+bool RollupReader::SmapsOrRollupPss(pid_t pid, uint64_t* pss) {
+    ssize_t size = Read(pid);
+    if (size < 0) {
+        return false;
+    }
+    MemUsage stats;
+    ParseSmapsText<kSmapsPss>(std::string_view(buffer_.data(), size), &stats);
+    *pss = stats.pss;
+    return true;
+}
+
+}  // namespace meminfo
+}  // namespace android
@@ -0,0 +1,290 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <fcntl.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <array>
+#include <string>
+#include <string_view>
+
+#include <android-base/logging.h>
+#include <android-base/unique_fd.h>
+
+#include <meminfo/meminfo.h>
+
+#include "procscan.h"
+
+// Internal parsers for /proc/<pid>/smaps and smaps_rollup. The fields a caller needs are picked
+// at compile time, e.g. ParseSmaps<kSmapsPss>(), and lines for other fields are skipped without
+// looking at their values.
+
+namespace android {
+namespace meminfo {
+
+// smaps fields, as bits of the field masks the parsers are instantiated with.
+enum SmapsField : uint32_t {
+    kSmapsSize = 1u << 0,
+    kSmapsRss = 1u << 1,
+    kSmapsPss = 1u << 2,
+    kSmapsSharedClean = 1u << 3,
+    kSmapsSharedDirty = 1u << 4,
+    kSmapsPrivateClean = 1u << 5,
+    kSmapsPrivateDirty = 1u << 6,
+    kSmapsSwap = 1u << 7,
+    kSmapsSwapPss = 1u << 8,
+    kSmapsAnonHugePages = 1u << 9,
+    kSmapsShmemPmdMapped = 1u << 10,
+    kSmapsFilePmdMapped = 1u << 11,
+    kSmapsSharedHugetlb = 1u << 12,
+    kSmapsPrivateHugetlb = 1u << 13,
+    kSmapsLocked = 1u << 14,
+};
+
+inline constexpr uint32_t kSmapsAllFields = (1u << 15) - 1;
+
+// The key of each field, by bit number. Private_Clean and Private_Dirty also add up to uss.
+inline constexpr std::string_view kSmapsFieldKeys[] = {
+        "Size:",
+        "Rss:",
+        "Pss:",
+        "Shared_Clean:",
+        "Shared_Dirty:",
+        "Private_Clean:",
+        "Private_Dirty:",
+        "Swap:",
+        "SwapPss:",
+        "AnonHugePages:",
+        "ShmemPmdMapped:",
+        "FilePmdMapped:",
+        "Shared_Hugetlb:",
+        "Private_Hugetlb:",
+        "Locked:",
+};
+
+inline constexpr uint64_t MemUsage::*kSmapsFieldMembers[] = {
+        &MemUsage::vss,
+        &MemUsage::rss,
+        &MemUsage::pss,
+        &MemUsage::shared_clean,
+        &MemUsage::shared_dirty,
+        &MemUsage::private_clean,
+        &MemUsage::private_dirty,
+        &MemUsage::swap,
+        &MemUsage::swap_pss,
+        &MemUsage::anon_huge_pages,
+        &MemUsage::shmem_pmd_mapped,
+        &MemUsage::file_pmd_mapped,
+        &MemUsage::shared_hugetlb,
+        &MemUsage::private_hugetlb,
+        &MemUsage::locked,
+};
+
+// The fields ProcMemInfo::SmapsOrRollup() reports.
+inline constexpr uint32_t kSmapsOrRollupFields =
+        kSmapsRss | kSmapsPss | kSmapsPrivateClean | kSmapsPrivateDirty | kSmapsSwapPss;
+
+static_assert(std::size(kSmapsFieldKeys) == std::size(kSmapsFieldMembers));
+static_assert(kSmapsAllFields == (1u << std::size(kSmapsFieldKeys)) - 1);
+
+// Keys are told apart by their length and last 4 bytes: the first bytes are shared by e.g.
+// Shared_Clean: and Shared_Dirty:, and the last one is always ':'. A multiplicative hash of
+// those, with a multiplier picked at compile time, maps each key to its own slot.
+inline constexpr size_t kSmapsKeyMinLen = 4;
+inline constexpr size_t kSmapsKeyMaxLen = 16;
+inline constexpr int kSmapsKeySlotBits = 6;
+
+constexpr uint32_t SmapsKeyHash(const char* key, size_t len, uint32_t multiplier) {
+    const char* tail = key + len - 4;
+    uint32_t word = static_cast<uint8_t>(tail[0]) | static_cast<uint8_t>(tail[1]) << 8 |
+                    static_cast<uint8_t>(tail[2]) << 16 | static_cast<uint32_t>(len) << 24;
+    return (word * multiplier) >> (32 - kSmapsKeySlotBits);
+}
+
+constexpr uint32_t FindSmapsKeyMultiplier() {
+    for (uint32_t multiplier = 0x9e3779b1; multiplier < 0x9e3779b1 + 2 * 4096; multiplier += 2) {
+        uint64_t used = 0;
+        bool collision = false;
+        for (std::string_view key : kSmapsFieldKeys) {
+            uint64_t slot = 1ull << SmapsKeyHash(key.data(), key.size(), multiplier);
+            collision |= (used & slot) != 0;
+            used |= slot;
+        }
+        if (!collision) return multiplier;
+    }
+    return 0;
+}
+
+inline constexpr uint32_t kSmapsKeyMultiplier = FindSmapsKeyMultiplier();
+static_assert(kSmapsKeyMultiplier != 0, "no perfect hash for the smaps keys");
+
+// Field bit number + 1 by slot, 0 for empty slots.
+inline constexpr std::array<uint8_t, 1 << kSmapsKeySlotBits> kSmapsKeySlots = [] {
+    std::array<uint8_t, 1 << kSmapsKeySlotBits> slots{};
+    for (size_t i = 0; i < std::size(kSmapsFieldKeys); i++) {
+        std::string_view key = kSmapsFieldKeys[i];
+        slots[SmapsKeyHash(key.data(), key.size(), kSmapsKeyMultiplier)] = i + 1;
+    }
+    return slots;
+}();
+
+// Returns true if 'line', without its newline, is a smaps stats line and false otherwise, e.g.
+// for the maps line starting a vma. Values of the fields in 'Fields' are added to 'stats'.
+template <uint32_t Fields>
+inline bool ParseSmapsField(std::string_view line, MemUsage* stats) {
+    const char* p = line.data();
+    const char* end = p + line.size();
+
+    // https://lore.kernel.org/patchwork/patch/1088579/ introduced tabs. Handle this case as well.
+    size_t key_len = FindBlank(p, line.size());
+    const char* key_end = p + key_len;
+    if (key_len == 0 || *(key_end - 1) != ':') {
+        return false;
+    }
+    if (key_len < kSmapsKeyMinLen || key_len > kSmapsKeyMaxLen) {
+        return true;
+    }
+
+    uint8_t slot = kSmapsKeySlots[SmapsKeyHash(p, key_len, kSmapsKeyMultiplier)];
+    if (slot == 0 || !(Fields & (1u << (slot - 1))) ||
+        kSmapsFieldKeys[slot - 1] != std::string_view(p, key_len)) {
+        return true;
+    }
+
+    const char* c = key_end;
+    while (c < end && IsProcBlank(*c)) c++;
+    uint64_t value;
+    ParseProcNumber<10>(c, end, &value);
+    stats->*kSmapsFieldMembers[slot - 1] += value;
+    if ((1u << (slot - 1)) & (kSmapsPrivateClean | kSmapsPrivateDirty)) {
+        stats->uss += value;
+    }
+    return true;
+}
+
+// Parses a maps line, e.g.
+// 00400000-00409000 r-xp 00000000 fc:00 426998  /usr/lib/gvfs/gvfsd-http
+// The name is returned as its offset into the line and its length, as the line may move before
+// the vma is handed out.
+bool ParseSmapsVmaHeader(std::string_view line, VmaView* vma, size_t* name_offset,
+                         size_t* name_len);
+
+// Calls 'fn(const VmaView&)' for each vma in the smaps or maps file at 'path', with the fields
+// in 'Fields' filled in if 'read_smaps_fields'. Stops and returns false if 'fn' does.
+template <uint32_t Fields, typename Fn>
+bool ForEachSmapsVma(const std::string& path, Fn&& fn, bool read_smaps_fields,
+                     std::string* buffer) {
+    ::android::base::unique_fd fd(TEMP_FAILURE_RETRY(open(path.c_str(), O_RDONLY | O_CLOEXEC)));
+    if (fd == -1) {
+        return false;
+    }
+
+    ProcFileLineReader reader(fd, buffer);
+    VmaView vma;
+    uint64_t name_position = 0;
+    size_t name_len = 0;
+    bool parsing_vma = false;
+
+    auto emit_vma = [&]() {
+        vma.name = std::string_view(reader.At(name_position), name_len);
+        return fn(vma);
+    };
+
+    std::string_view line;
+    while (reader.Next(&line)) {
+        if (parsing_vma) {
+            if (ParseSmapsField<Fields>(line, &vma.usage)) {
+                // This was a stats field
+                continue;
+            }
+
+            // Done collecting stats, make the call back
+            if (!emit_vma()) {
+                return false;
+            }
+            parsing_vma = false;
+            reader.Keep(ProcFileLineReader::kKeepNone);
+        }
+
+        vma.usage.clear();
+        size_t name_offset;
+        if (!ParseSmapsVmaHeader(line, &vma, &name_offset, &name_len)) {
+            LOG(ERROR) << "Failed to parse " << path;
+            return false;
+        }
+        name_position = reader.Position(line.data() + name_offset);
+        if (read_smaps_fields) {
+            // The name has to stay in the buffer while the fields are read.
+            reader.Keep(name_position);
+            parsing_vma = true;
+        } else if (!emit_vma()) {
+            return false;
+        }
+    }
+    if (reader.error()) {
+        PLOG(ERROR) << "Failed to read " << path;
+        return false;
+    }
+
+    if (parsing_vma) {
+        if (!emit_vma()) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+// Sets 'stats' to the sums of the fields in 'Fields' over all vmas in the smaps or
+// smaps_rollup file at 'path'.
+template <uint32_t Fields>
+bool ParseSmaps(const std::string& path, MemUsage* stats, std::string* buffer = nullptr) {
+    ::android::base::unique_fd fd(TEMP_FAILURE_RETRY(open(path.c_str(), O_RDONLY | O_CLOEXEC)));
+    if (fd == -1) {
+        return false;
+    }
+
+    ProcFileLineReader reader(fd, buffer);
+    stats->clear();
+    std::string_view line;
+    while (reader.Next(&line)) {
+        ParseSmapsField<Fields>(line, stats);
+    }
+    if (reader.error()) {
+        PLOG(ERROR) << "Failed to read " << path;
+        return false;
+    }
+    return true;
+}
+
+// Same as ParseSmaps(), for the contents of a file.
+template <uint32_t Fields>
+void ParseSmapsText(std::string_view text, MemUsage* stats) {
+    LineScanner lines(text);
+    stats->clear();
+    std::string_view line;
+    while (lines.Next(&line)) {
+        ParseSmapsField<Fields>(line, stats);
+    }
+}
+
+}  // namespace meminfo
+}  // namespace android
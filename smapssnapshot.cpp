@@ -0,0 +1,94 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdio.h>
+
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <meminfo/procmeminfo.h>
+#include <meminfo/smapssnapshot.h>
+
+namespace android {
+namespace meminfo {
+
+static bool same_vma(const Vma& a, const Vma& b) {
+    return a.start == b.start && a.end == b.end && a.inode == b.inode && a.offset == b.offset &&
+           a.flags == b.flags && a.name == b.name;
+}
+
+void DiffVmas(std::span<const Vma> old, std::span<const Vma> cur, VmaDelta* delta) {
+    delta->clear();
+    size_t i = 0, j = 0;
+    while (i < old.size() && j < cur.size()) {
+        if (old[i].start < cur[j].start) {
+            delta->removed.emplace_back(old[i++]);
+        } else if (cur[j].start < old[i].start) {
+            delta->added.emplace_back(cur[j++]);
+        } else if (!same_vma(old[i], cur[j])) {
+            // Remapped at the same address.
+            delta->removed.emplace_back(old[i++]);
+            delta->added.emplace_back(cur[j++]);
+        } else {
+            if (cur[j].usage != old[i].usage) {
+                VmaChange& change = delta->changed.emplace_back();
+                change.vma = cur[j];
+                change.grown = cur[j].usage;
+                change.grown.SaturatingSub(old[i].usage);
+                change.shrunk = old[i].usage;
+                change.shrunk.SaturatingSub(cur[j].usage);
+            }
+            i++;
+            j++;
+        }
+    }
+    delta->removed.insert(delta->removed.end(), old.begin() + i, old.end());
+    delta->added.insert(delta->added.end(), cur.begin() + j, cur.end());
+}
+
+bool SmapsSnapshot::Update(VmaDelta* delta) {
+    char path[64];
+    snprintf(path, sizeof(path), "/proc/%d/smaps", pid_);
+    path_.assign(path);
+    return UpdateFromFile(path_, delta);
+}
+
+bool SmapsSnapshot::UpdateFromFile(const std::string& path, VmaDelta* delta) {
+    size_t nr_vmas = 0;
+    auto store_vma = [&](const VmaView& view) {
+        // Assigning the view to an existing entry reuses the storage of its name; only entries
+        // past the end of the older snapshot are new.
+        if (nr_vmas == next_.size()) {
+            next_.emplace_back();
+        }
+        next_[nr_vmas++] = view;
+        return true;
+    };
+    if (!ForEachVmaViewFromFile(path, store_vma, true, &buffer_)) {
+        return false;
+    }
+    next_.resize(nr_vmas);
+
+    if (delta != nullptr) {
+        DiffVmas(vmas_, next_, delta);
+    }
+    std::swap(vmas_, next_);
+    return true;
+}
+
+}  // namespace meminfo
+}  // namespace android
@@ -0,0 +1,72 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <algorithm>
+#include <vector>
+
+#include "meminfo_private.h"
+
+namespace android {
+namespace meminfo {
+
+void SwapSlotList::Assign(std::vector<uint64_t>* slots) {
+    clear();
+    std::sort(slots->begin(), slots->end());
+
+    static constexpr uint64_t kOffsetMask = (1ULL << kTypeShift) - 1;
+    uint64_t prev_offset = 0;
+    for (uint64_t slot : *slots) {
+        uint32_t type = slot >> kTypeShift;
+        uint64_t offset = slot & kOffsetMask;
+        if (runs_.empty() || runs_.back().type != type) {
+            runs_.push_back({.type = type, .size = 0, .begin = deltas_.size(), .max_offset = 0});
+            prev_offset = 0;
+        }
+
+        uint64_t delta = offset - prev_offset;
+        do {
+            uint8_t byte = delta & 0x7f;
+            delta >>= 7;
+            deltas_.push_back(delta ? byte | 0x80 : byte);
+        } while (delta);
+
+        runs_.back().size++;
+        runs_.back().max_offset = offset;
+        prev_offset = offset;
+    }
+    size_ = slots->size();
+    deltas_.shrink_to_fit();
+}
+
+void SwapSlotList::Append(std::vector<uint64_t>* slots) {
+    if (slots->empty()) return;
+
+    slots->reserve(slots->size() + size_);
+    ForEach([&](uint32_t type, uint64_t offset) { slots->push_back(Slot(type, offset)); });
+    Assign(slots);
+}
+
+int64_t SwapSlotList::MaxOffset(uint32_t type) const {
+    for (const Run& run : runs_) {
+        if (run.type == type) {
+            return run.max_offset;
+        }
+    }
+    return -1;
+}
+
+}  // namespace meminfo
+}  // namespace android
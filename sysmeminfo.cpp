@@ -47,6 +47,7 @@
 #include <dmabufinfo/dmabuf_sysfs_stats.h>
 
 #include "meminfo_private.h"
+#include "procscan.h"
 
 namespace android {
 namespace meminfo {
@@ -103,12 +104,12 @@ bool SysMemInfo::ReadMemInfo(const char* path, size_t ntags, const std::string_v
         return false;
     }
 
-    buffer[len] = '\0';
-    char* p = buffer;
+    LineScanner lines(std::string_view(buffer, len));
+    std::string_view line;
     uint32_t found = 0;
     uint32_t lineno = 0;
     bool zram_tag_found = false;
-    while (*p && found < ntags) {
+    while (found < ntags && lines.Next(&line)) {
         for (size_t tagno = 0; tagno < ntags; ++tagno) {
             const std::string_view& tag = tags[tagno];
             // Special case for "Zram:" tag that android_os_Debug and friends look
@@ -120,26 +121,20 @@ bool SysMemInfo::ReadMemInfo(const char* path, size_t ntags, const std::string_v
                 continue;
             }
 
-            if (strncmp(p, tag.data(), tag.size()) == 0) {
-                p += tag.size();
-                while (*p == ' ') p++;
-                char* endptr = nullptr;
-                uint64_t val = strtoull(p, &endptr, 10);
-                if (p == endptr) {
+            if (line.starts_with(tag)) {
+                const char* p = line.data() + tag.size();
+                const char* end = line.data() + line.size();
+                while (p < end && *p == ' ') p++;
+                uint64_t val;
+                if (ParseProcNumber<10>(p, end, &val) == p) {
                     PLOG(ERROR) << "Failed to parse line:" << lineno + 1 << " in file: " << path;
                     return false;
                 }
                 store_val(tag, val);
-                p = endptr;
                 found++;
                 break;
             }
         }
-
-        while (*p && *p != '\n') {
-            p++;
-        }
-        if (*p) p++;
         lineno++;
     }
 
@@ -263,14 +258,14 @@ bool SysMemInfo::GetTotalMemCompacted(const char* zram_dev, uint64_t* out_mem_co
 // Public methods
 uint64_t ReadVmallocInfo(const char* path) {
     uint64_t vmalloc_total = 0;
-    auto fp = std::unique_ptr<FILE, decltype(&fclose)>{fopen(path, "re"), fclose};
-    if (fp == nullptr) {
+    ::android::base::unique_fd fd(TEMP_FAILURE_RETRY(open(path, O_RDONLY | O_CLOEXEC)));
+    if (fd == -1) {
         return vmalloc_total;
     }
 
-    char* line = nullptr;
-    size_t line_alloc = 0;
-    while (getline(&line, &line_alloc, fp.get()) > 0) {
+    ProcFileLineReader reader(fd, nullptr);
+    std::string_view line;
+    while (reader.Next(&line)) {
         // We are looking for lines like
         //
         // 0x0000000000000000-0x0000000000000000   12288 drm_property_create_blob+0x44/0xec pages=2 vmalloc
@@ -279,20 +274,19 @@ uint64_t ReadVmallocInfo(const char* path) {
         // Notice that if the caller is coming from a module, the kernel prints and extra
         // "[module_name]" after the address and the symbol of the call site. This means we can't
         // use the old sscanf() method of getting the # of pages.
-        char* p_start = strstr(line, "pages=");
-        if (p_start == nullptr) {
+        size_t pos = line.find("pages=");
+        if (pos == std::string_view::npos) {
             // we didn't find anything
             continue;
         }
 
+        const char* p = line.data() + pos + strlen("pages=");
         uint64_t nr_pages;
-        if (sscanf(p_start, "pages=%" SCNu64 "", &nr_pages) == 1) {
+        if (ParseProcNumber<10>(p, line.data() + line.size(), &nr_pages) != p) {
             vmalloc_total += (nr_pages * getpagesize());
         }
     }
 
-    free(line);
-
     return vmalloc_total;
 }
 
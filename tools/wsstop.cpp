@@ -24,24 +24,30 @@
 #include <algorithm>
 #include <memory>
 #include <string>
+#include <utility>
 #include <vector>
 
 #include <meminfo/pageacct.h>
-#include <meminfo/procmeminfo.h>
+#include <meminfo/smapssnapshot.h>
+#include <meminfo/workingsettracker.h>
 
-using ::android::meminfo::ProcMemInfo;
+using ::android::meminfo::SmapsSnapshot;
 using ::android::meminfo::Vma;
+using ::android::meminfo::VmaDelta;
+using ::android::meminfo::WorkingSetTracker;
 
 // Global options
-static int32_t g_delay = 0;
+static int32_t g_delay = 1;
 static int32_t g_total = 2;
 static pid_t g_pid = -1;
+static bool g_smaps_growth = false;
 
 [[noreturn]] static void usage(int exit_status) {
     fprintf(stderr,
-            "%s [-d DELAY_BETWEEN_EACH_SAMPLE] [-n REFRESH_TOTAL] PID\n"
-            "-d\tdelay between each working set sample (default 0)\n"
-            "-n\ttotal number of refreshes before we exit (default 2)\n",
+            "%s [-d DELAY_BETWEEN_EACH_SAMPLE] [-n REFRESH_TOTAL] [-s] PID\n"
+            "-d\tdelay between each working set sample, in seconds (default 1)\n"
+            "-n\ttotal number of refreshes before we exit (default 2)\n"
+            "-s\tshow how much the smaps usage of each vma grew over each delay instead\n",
             getprogname());
 
     exit(exit_status);
@@ -74,102 +80,84 @@ static void print_vma(const Vma& v) {
     printf("%s\n", v.name.c_str());
 }
 
-static bool same_vma(const Vma& cur, const Vma& last) {
-    return (cur.start == last.start && cur.end == last.end && cur.name == last.name &&
-            cur.flags == last.flags && cur.offset == last.offset);
-}
+// Prints the vmas of sample 'nr_refresh' that have any rss.
+static void print_sample(std::vector<Vma>& vmas, uint32_t nr_refresh) {
+    vmas.erase(std::remove_if(vmas.begin(), vmas.end(),
+                              [](const auto& v) { return v.usage.rss == 0; }),
+               vmas.end());
+    if ((nr_refresh % 5) == 0) {
+        print_header();
+        print_divider();
+    }
 
-static Vma diff_vma_params(const Vma& cur, const Vma& last) {
-    Vma res;
-    res.usage.shared_clean = cur.usage.shared_clean > last.usage.shared_clean
-                                     ? cur.usage.shared_clean - last.usage.shared_clean
-                                     : 0;
-    res.usage.shared_dirty = cur.usage.shared_dirty > last.usage.shared_dirty
-                                     ? cur.usage.shared_dirty - last.usage.shared_dirty
-                                     : 0;
-    res.usage.private_clean = cur.usage.private_clean > last.usage.private_clean
-                                      ? cur.usage.private_clean - last.usage.private_clean
-                                      : 0;
-    res.usage.private_dirty = cur.usage.private_dirty > last.usage.private_dirty
-                                      ? cur.usage.private_dirty - last.usage.private_dirty
-                                      : 0;
-
-    res.usage.rss = cur.usage.rss > last.usage.rss ? cur.usage.rss - last.usage.rss : 0;
-    res.usage.pss = cur.usage.pss > last.usage.pss ? cur.usage.pss - last.usage.pss : 0;
-    res.usage.uss = cur.usage.uss > last.usage.uss ? cur.usage.uss - last.usage.uss : 0;
-    res.usage.swap = cur.usage.swap > last.usage.swap ? cur.usage.swap - last.usage.swap : 0;
-    res.usage.swap_pss =
-            cur.usage.swap_pss > last.usage.swap_pss ? cur.usage.swap_pss - last.usage.swap_pss : 0;
-
-    // set vma properties to the same as the current one.
-    res.start = cur.start;
-    res.end = cur.end;
-    res.offset = cur.offset;
-    res.flags = cur.flags;
-    res.name = cur.name;
-    return res;
+    for (const auto& v : vmas) {
+        print_vma(v);
+    }
 }
 
-static void diff_workingset(std::vector<Vma>& wss, std::vector<Vma>& old, std::vector<Vma>* res) {
-    res->clear();
-    auto vma_sorter = [](const Vma& a, const Vma& b) { return a.start < b.start; };
-    std::sort(wss.begin(), wss.end(), vma_sorter);
-    std::sort(old.begin(), old.end(), vma_sorter);
-    if (old.empty()) {
-        *res = wss;
-        return;
-    }
+static int workingset() {
+    std::vector<Vma> wss;
+    uint32_t nr_refresh = 0;
 
-    for (auto& i : wss) {
-        bool found_same_vma = false;
-        // TODO: This is highly inefficient, fix it if it takes
-        // too long. Worst case will be system_server
-        for (auto& j : old) {
-            if (same_vma(i, j)) {
-                res->emplace_back(diff_vma_params(i, j));
-                found_same_vma = true;
-                break;
-            }
+    // Each sample is the working set over one delay, so it is printed as is.
+    WorkingSetTracker tracker(g_pid);
+    while (true) {
+        if (!tracker.Arm()) {
+            fprintf(stderr, "Failed to start tracking the working set of process %d\n", g_pid);
+            return 1;
+        }
+        sleep(g_delay);
+        if (!tracker.Collect(&wss)) {
+            fprintf(stderr, "Failed to read the working set of process %d\n", g_pid);
+            return 1;
         }
 
-        if (!found_same_vma) {
-            res->emplace_back(i);
+        print_sample(wss, nr_refresh);
+        nr_refresh++;
+        if (nr_refresh == g_total) {
+            break;
         }
+
+        print_divider();
     }
 
-    std::sort(res->begin(), res->end(), vma_sorter);
-    return;
+    return 0;
 }
 
-static int workingset() {
-    std::vector<Vma> last_wss = {};
-    std::vector<Vma> diff_wss = {};
-    uint32_t nr_refresh = 0;
+static int smaps_growth() {
+    SmapsSnapshot snapshot(g_pid);
+    if (!snapshot.Update(nullptr)) {
+        fprintf(stderr, "Failed to read smaps of process %d\n", g_pid);
+        return 1;
+    }
 
+    // smaps usage isn't per interval, so each sample is its growth since the one before: new
+    // vmas with all of their usage, others with how much it grew. Vmas that only shrank or
+    // went away aren't shown.
+    VmaDelta delta;
+    std::vector<Vma> grown;
+    uint32_t nr_refresh = 0;
     while (true) {
-        std::unique_ptr<ProcMemInfo> proc_mem = std::make_unique<ProcMemInfo>(g_pid, true);
-        std::vector<Vma> wss = proc_mem->MapsWithPageIdle();
-
-        diff_workingset(wss, last_wss, &diff_wss);
-        diff_wss.erase(std::remove_if(diff_wss.begin(), diff_wss.end(),
-                                      [](const auto& v) { return v.usage.rss == 0; }),
-                       diff_wss.end());
-        if ((nr_refresh % 5) == 0) {
-            print_header();
-            print_divider();
+        sleep(g_delay);
+        if (!snapshot.Update(&delta)) {
+            fprintf(stderr, "Failed to read smaps of process %d\n", g_pid);
+            return 1;
         }
 
-        for (const auto& v : diff_wss) {
-            print_vma(v);
+        grown.swap(delta.added);
+        for (auto& change : delta.changed) {
+            change.vma.usage = change.grown;
+            grown.emplace_back(std::move(change.vma));
         }
+        std::sort(grown.begin(), grown.end(),
+                  [](const Vma& a, const Vma& b) { return a.start < b.start; });
 
+        print_sample(grown, nr_refresh);
         nr_refresh++;
         if (nr_refresh == g_total) {
             break;
         }
 
-        last_wss = wss;
-        sleep(g_delay);
         print_divider();
     }
 
@@ -183,7 +171,7 @@ int main(int argc, char* argv[]) {
     };
 
     int opt;
-    while ((opt = getopt_long(argc, argv, "d:n:h", longopts, nullptr)) != -1) {
+    while ((opt = getopt_long(argc, argv, "d:n:hs", longopts, nullptr)) != -1) {
         switch (opt) {
             case 'd':
                 g_delay = atoi(optarg);
@@ -191,6 +179,9 @@ int main(int argc, char* argv[]) {
             case 'n':
                 g_total = atoi(optarg);
                 break;
+            case 's':
+                g_smaps_growth = true;
+                break;
             case 'h':
                 usage(EXIT_SUCCESS);
             default:
@@ -203,12 +194,22 @@ int main(int argc, char* argv[]) {
         usage(EXIT_FAILURE);
     }
 
+    // Each sample is the working set over one delay, which would be close to empty without one.
+    if (g_delay <= 0) {
+        fprintf(stderr, "Invalid delay %d: Must be at least 1 second\n", g_delay);
+        usage(EXIT_FAILURE);
+    }
+
     g_pid = atoi(argv[optind]);
     if (g_pid <= 0) {
         fprintf(stderr, "Invalid process id %s\n", argv[optind]);
         usage(EXIT_FAILURE);
     }
 
+    if (g_smaps_growth) {
+        return smaps_growth();
+    }
+
     if (!::android::meminfo::PageAcct::KernelHasPageIdle()) {
         fprintf(stderr, "Missing support for Idle page tracking in the kernel\n");
         return 0;
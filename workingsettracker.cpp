@@ -0,0 +1,149 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <linux/kernel-page-flags.h>
+#include <unistd.h>
+
+#include <span>
+#include <vector>
+
+#include <android-base/logging.h>
+
+#include "meminfo_private.h"
+
+namespace android {
+namespace meminfo {
+
+bool WorkingSetTracker::Arm() {
+    armed_ = false;
+
+    ProcMemInfo proc_mem(pid_);
+    const std::vector<Vma>& maps = proc_mem.MapsWithoutUsageStats();
+    if (maps.empty()) {
+        LOG(ERROR) << "Failed to read maps for Process " << pid_;
+        return false;
+    }
+
+    // Reads the page map of all vmas through one open file and buffer.
+    if (!proc_mem.BeginSession()) {
+        LOG(ERROR) << "Failed to open page map for Process " << pid_;
+        return false;
+    }
+
+    // The page map of every vma is read again, see the class comment. Only the storage of the
+    // lists is kept.
+    vmas_.clear();
+    vma_pfns_.clear();
+    pfns_.clear();
+    auto collect_pfns = [this](std::span<const uint64_t> entries, uint64_t) {
+        for (uint64_t page_info : entries) {
+            if (PAGE_PRESENT(page_info)) {
+                pfns_.emplace_back(PAGE_PFN(page_info));
+            }
+        }
+        return true;
+    };
+    for (const Vma& vma : maps) {
+        vmas_.emplace_back(vma);
+        vma_pfns_.emplace_back(pfns_.size());
+        if (!proc_mem.ForEachPageMapChunk(vma, collect_pfns)) {
+            LOG(ERROR) << "Failed to read page map for vma " << vma.name << "[" << vma.start
+                       << "-" << vma.end << "]";
+            Reset();
+            return false;
+        }
+    }
+    vma_pfns_.emplace_back(pfns_.size());
+
+    if (!PageAcct::Instance().MarkPagesIdle(pfns_)) {
+        LOG(ERROR) << "Failed to mark pages of process " << pid_ << " idle";
+        Reset();
+        return false;
+    }
+
+    armed_ = true;
+    return true;
+}
+
+bool WorkingSetTracker::Collect(std::vector<Vma>* wss) {
+    wss->clear();
+    if (!armed_) {
+        LOG(ERROR) << "Working set of process " << pid_ << " collected before Arm()";
+        return false;
+    }
+    armed_ = false;
+
+    PageAcct& pinfo = PageAcct::Instance();
+    std::vector<uint8_t> idle(pfns_.size());
+    if (!pinfo.GetPagesIdle(pfns_, idle)) {
+        LOG(ERROR) << "Failed to read idle state of pages of process " << pid_;
+        return false;
+    }
+
+    std::vector<uint64_t> accessed;
+    for (size_t i = 0; i < pfns_.size(); i++) {
+        if (!idle[i]) {
+            accessed.emplace_back(pfns_[i]);
+        }
+    }
+
+    std::vector<uint64_t> page_flags(accessed.size());
+    std::vector<uint64_t> page_counts(accessed.size());
+    if (!pinfo.PageFlagsBatch(accessed, page_flags) ||
+        !pinfo.PageMapCountBatch(accessed, page_counts)) {
+        LOG(ERROR) << "Failed to get page flags and counts of process " << pid_;
+        return false;
+    }
+
+    uint64_t pagesz_kb = getpagesize() / 1024;
+    size_t cur = 0;
+    for (size_t i = 0; i < vmas_.size(); i++) {
+        Vma& vma = wss->emplace_back(vmas_[i]);
+        vma.clear();
+        for (size_t j = vma_pfns_[i]; j < vma_pfns_[i + 1]; j++) {
+            if (idle[j]) continue;
+
+            uint64_t cur_page_flags = page_flags[cur];
+            uint64_t cur_page_counts = page_counts[cur];
+            cur++;
+
+            // Page was freed since Arm().
+            if (cur_page_counts == 0) continue;
+
+            bool is_dirty = !!(cur_page_flags & (1 << KPF_DIRTY));
+            bool is_private = (cur_page_counts == 1);
+            vma.usage.vss += pagesz_kb;
+            vma.usage.rss += pagesz_kb;
+            vma.usage.uss += is_private ? pagesz_kb : 0;
+            vma.usage.pss += pagesz_kb / cur_page_counts;
+            if (KPAGEFLAG_THP(cur_page_flags)) {
+                vma.usage.thp += pagesz_kb;
+            }
+            if (is_private) {
+                vma.usage.private_dirty += is_dirty ? pagesz_kb : 0;
+                vma.usage.private_clean += is_dirty ? 0 : pagesz_kb;
+            } else {
+                vma.usage.shared_dirty += is_dirty ? pagesz_kb : 0;
+                vma.usage.shared_clean += is_dirty ? 0 : pagesz_kb;
+            }
+        }
+    }
+
+    return true;
+}
+
+}  // namespace meminfo
+}  // namespace android